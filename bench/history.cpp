@@ -0,0 +1,95 @@
+/**
+ * @file
+ *
+ * Benchmark of persistent History with 10M messages. Messages are appended
+ * round-robin over conversations, then the history is reopened (restart
+ * of the server) and HIST is served from mapped segments.
+ *
+ * Usage: cchat-bench-history [dir], the directory is removed afterwards.
+**/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+#include "history.hpp"
+
+
+constexpr std::size_t MESSAGES = 10'000'000;
+constexpr std::size_t PAIRS = 10'000;
+constexpr std::size_t MESSAGE_SIZE = 40;
+constexpr std::size_t HIST_COUNT = 100; // messages per HIST request
+constexpr std::size_t HIST_REQUESTS = 100'000;
+
+
+auto seconds_since(std::chrono::steady_clock::time_point start) -> double
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+auto disk_usage(const std::string& dir) -> std::size_t
+{
+    std::size_t size = 0;
+    for (auto&& entry : std::filesystem::directory_iterator(dir)) { size += entry.file_size(); }
+    return size;
+}
+
+auto run(const std::string& dir, std::size_t retention) -> void
+{
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    std::vector<UserPair> pairs;
+    for (std::size_t i = 0; i < PAIRS; ++i) { pairs.emplace_back("alice" + std::to_string(i), "bob" + std::to_string(i)); }
+
+    const auto body = std::make_shared<const Message>(MESSAGE_SIZE, 'x');
+    double append = 0;
+
+    {
+        History history;
+        history.open(dir, retention);
+
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t k = 0; k < MESSAGES; ++k) { history.push_back(pairs[k % PAIRS], { body }); }
+        append = seconds_since(start);
+    }
+
+    // restart, the index is rebuilt from segments left by compaction
+    History history;
+    auto start = std::chrono::steady_clock::now();
+    auto recovered = history.open(dir, retention);
+    auto restart = seconds_since(start);
+
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<std::size_t> pick(0, PAIRS - 1);
+    std::vector<double> latencies;
+    latencies.reserve(HIST_REQUESTS);
+
+    for (std::size_t i = 0; i < HIST_REQUESTS; ++i) {
+        auto t = std::chrono::steady_clock::now();
+        auto msgs = history.get_last_n(pairs[pick(gen)], HIST_COUNT);
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t).count());
+        if (msgs.size() != std::min(HIST_COUNT, retention)) { std::fprintf(stderr, "short HIST reply\n"); }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    std::printf(
+        "retention %4zu: append %5.2f M msg/s, %6.1f MB on disk, restart %5.2f s (%zu records), "
+        "hist %zu p50 %5.1f us, p99 %5.1f us\n",
+        retention, MESSAGES / append / 1e6, disk_usage(dir) / 1e6, restart, recovered,
+        HIST_COUNT, latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100]);
+}
+
+auto main(int argc, char* argv[]) -> int
+{
+    std::string dir = (argc > 1) ? (argv[1]) : ("/tmp/cchat-bench-history");
+
+    // default retention keeps everything, the shorter one lets compaction drop segments
+    for (std::size_t retention : { 1000, 100 }) { run(dir, retention); }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
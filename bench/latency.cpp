@@ -0,0 +1,171 @@
+/**
+ * @file
+ *
+ * Benchmark of end-to-end chat latency. A server runs in-process, two users
+ * chat with each other over loopback and one of them measures the round
+ * trip of a ping (sent to the opponent and echoed back) in thread and
+ * reactor modes.
+ *
+ * Usage: cchat-bench-latency [port], modes use two consecutive ports.
+**/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "server_entity.hpp"
+#include "utility.hpp"
+
+
+constexpr std::size_t PINGS = 10'000;
+constexpr std::size_t WARMUP = 100;
+
+
+/**
+ * @brief Blocking client speaking the length-prefixed protocol.
+**/
+class Peer final
+{
+private:
+    int sock_;
+
+public:
+    Peer(uint16_t port, const std::string& name)
+        : sock_(create_new_socket())
+    {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (connect(sock_, (sockaddr *)&addr, sizeof(addr)) == -1) {
+            throw std::runtime_error("Benchmark cannot connect to the server.");
+        }
+
+        set_socket_no_delay(sock_);
+        send(name);
+        recv();
+    }
+
+    auto send(const std::string& msg) -> void
+    {
+        uint32_t len = htonl(msg.size());
+        std::string packet(reinterpret_cast<const char*>(&len), sizeof(len));
+        packet.append(msg);
+
+        for (std::size_t done = 0; done < packet.size();) {
+            auto cnt = ::send(sock_, packet.data() + done, packet.size() - done, MSG_NOSIGNAL);
+            if (cnt <= 0) { throw std::runtime_error("Benchmark cannot send a message."); }
+            done += cnt;
+        }
+    }
+
+    auto recv() -> std::string
+    {
+        auto read_exactly = [&](char* data, std::size_t len) {
+            for (std::size_t done = 0; done < len;) {
+                auto cnt = ::recv(sock_, data + done, len - done, 0);
+                if (cnt <= 0) { throw std::runtime_error("Benchmark cannot receive a message."); }
+                done += cnt;
+            }
+        };
+
+        uint32_t len;
+        read_exactly(reinterpret_cast<char*>(&len), sizeof(len));
+
+        std::string msg(ntohl(len), '\0');
+        read_exactly(msg.data(), msg.size());
+        return msg;
+    }
+
+    Peer(Peer&&) = delete;
+    Peer(const Peer&) = delete;
+    Peer& operator=(Peer&&) = delete;
+    Peer& operator=(const Peer&) = delete;
+
+    ~Peer() { close(sock_); }
+};
+
+/**
+ * @brief Starts a server in the background, it is never destroyed.
+**/
+auto start_server(const std::string& mode, uint16_t port, const std::string& log) -> void
+{
+    std::vector<std::string> opts = {
+        "cchat-server", "--port=" + std::to_string(port), "--mode=" + mode, "--workers=1", "--log-file=" + log
+    };
+
+    std::vector<char*> argv;
+    for (auto&& opt : opts) { argv.push_back(opt.data()); }
+
+    // getopt keeps its state between servers
+    optind = 0;
+
+    ServerArgsParser parser;
+    parser.parse(static_cast<int>(argv.size()), argv.data());
+
+    // listening socket accepts connections as soon as init returns
+    auto server = new Server();
+    server->init(parser);
+    std::thread([server]() { server->loop(); }).detach();
+}
+
+auto run(const std::string& mode, uint16_t port, const std::string& log) -> void
+{
+    start_server(mode, port, log);
+
+    Peer alice(port, "alice");
+    Peer bob(port, "bob");
+
+    alice.send("chat bob");
+    alice.recv();
+    bob.send("chat alice");
+    bob.recv();
+
+    std::vector<double> latencies;
+    latencies.reserve(PINGS);
+
+    for (std::size_t i = 0; i < WARMUP + PINGS; ++i) {
+        auto msg = "ping " + std::to_string(i);
+
+        auto start = std::chrono::steady_clock::now();
+        alice.send(msg);
+        bob.send(bob.recv());
+        if (alice.recv() != msg) { throw std::runtime_error("Ping came back corrupted."); }
+
+        auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        if (i >= WARMUP) { latencies.push_back(elapsed); }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    std::printf(
+        "%-7s: round trip p50 %7.1f us, p99 %7.1f us, max %7.1f us\n",
+        mode.c_str(), latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+}
+
+auto main(int argc, char* argv[]) -> int
+{
+    uint16_t port = (argc > 1) ? (parse_port(argv[1])) : (24000);
+    std::string log = (std::filesystem::temp_directory_path() / "cchat-bench-latency.log").string();
+
+    run("thread", port, log + ".thread");
+    run("reactor", port + 1, log + ".reactor");
+
+    std::error_code ec;
+    std::filesystem::remove(log + ".thread", ec);
+    std::filesystem::remove(log + ".reactor", ec);
+
+    // servers have no shutdown, the process ends without destroying them
+    std::fflush(stdout);
+    std::quick_exit(0);
+}
@@ -0,0 +1,82 @@
+/**
+ * @file
+ *
+ * Benchmark of server logging into the rotating file sink. Producers log
+ * chat records as fast as they can, the logger thread formats and writes
+ * them with periodic fdatasync.
+ *
+ * Usage: cchat-bench-log [path], the file is removed afterwards.
+**/
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include "log_file.hpp"
+#include "log_record.hpp"
+#include "logger.hpp"
+
+
+constexpr std::size_t RECORDS = 1 << 22; // records logged by all producers together
+
+
+auto run(const std::string& path, std::size_t producers, LoggerOverflow overflow) -> void
+{
+    std::size_t size = 0;
+    double elapsed = 0;
+    std::size_t dropped = 0;
+
+    {
+        LogFile file(path, 0, std::chrono::seconds(0), std::chrono::milliseconds(100));
+        ServerLogger logger(&file, 1 << 16, overflow);
+
+        std::atomic_bool done(false);
+        std::thread consumer([&]() { logger.loop(done); });
+
+        auto user = LogNames::intern("alice");
+        auto opponent = LogNames::intern("bob");
+        auto per = RECORDS / producers;
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (std::size_t p = 0; p < producers; ++p) {
+            threads.emplace_back([&]() {
+                for (std::size_t i = 0; i < per; ++i) { logger.log(LogRecord(LogFormat::CHAT_STARTED, user, opponent)); }
+            });
+        }
+
+        for (auto&& thread : threads) { thread.join(); }
+
+        // the consumer drains what is left before it stops
+        done.store(true);
+        consumer.join();
+
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        dropped = logger.dropped();
+    }
+
+    // rotation is disabled, everything lands in one file
+    std::error_code ec;
+    size = std::filesystem::file_size(path, ec);
+    std::filesystem::remove(path, ec);
+
+    std::printf(
+        "%2zu producers, %s: %6.2f M records/s, %6.1f MB/s, %zu dropped\n",
+        producers, (overflow == LoggerOverflow::BLOCK) ? "block" : "drop ",
+        (RECORDS / producers * producers - dropped) / elapsed / 1e6, size / elapsed / 1e6, dropped);
+}
+
+auto main(int argc, char* argv[]) -> int
+{
+    std::string path = (argc > 1) ? (argv[1]) : ("/tmp/cchat-bench.log");
+
+    for (std::size_t producers : { 1, 4, 16 }) {
+        run(path, producers, LoggerOverflow::BLOCK);
+        run(path, producers, LoggerOverflow::DROP);
+    }
+
+    return 0;
+}
@@ -0,0 +1,126 @@
+/**
+ * @file
+ *
+ * Microbenchmark of text command parsing, decode_text_command against
+ * the original allocating parser kept below for comparison.
+**/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "message.hpp"
+
+
+constexpr std::size_t ROUNDS = 1 << 22; // commands parsed by each parser
+
+
+/**
+ * @brief Original parser, words are copied into strings and keywords are
+ *     looked up in a freshly built map.
+**/
+namespace original {
+
+auto split_string(const std::string& input) -> std::vector<std::string>
+{
+    std::string token;
+    std::vector<std::string> result;
+    std::unordered_set<char> seps{ ' ', '\t', '\r' };
+
+    for (std::size_t i = 0; i < input.size(); ++i) {
+        if (seps.contains(input[i])) {
+            if (token.size() > 0) { result.emplace_back(std::move(token)); }
+        } else {
+            token.push_back(input[i]);
+        }
+    }
+
+    if (token.size() > 0) { result.emplace_back(std::move(token)); }
+
+    return result;
+}
+
+auto is_user_name_valid(const std::string& name) -> bool
+{
+    return name.size() > 0 && std::all_of(name.begin(), name.end(), [](char c) { return std::isalnum(c); });
+}
+
+auto is_hist_count_valid(const std::string& cnt) -> bool
+{
+    auto d = std::all_of(cnt.begin(), cnt.end(), [](char c) { return std::isdigit(c); });
+    return d && std::strtoul(cnt.c_str(), nullptr, 10) <= 10;
+}
+
+auto parse_command(const std::string& input) -> Command
+{
+    auto words = split_string(input);
+
+    if (words.size() == 1) {
+        std::map<std::string, Command> m {
+            { "help", Command::HELP },
+            { "pend", Command::PEND },
+            { "quit", Command::QUIT }
+        };
+
+        auto it = m.find(words[0]);
+        if (it != m.end()) { return it->second; }
+    }
+
+    if (words.size() == 2 && words[0] == "chat" && is_user_name_valid(words[1])) { return Command::CHAT; }
+
+    if (words.size() == 3 && words[0] == "hist" && is_hist_count_valid(words[1]) && is_user_name_valid(words[2])) { return Command::HIST; }
+
+    return Command::BAD;
+}
+
+auto parse_hist_command(const std::string& command) -> std::pair<unsigned long, std::string>
+{
+    auto tokens = split_string(command);
+    return { std::strtoul(tokens[1].c_str(), nullptr, 10), std::move(tokens[2]) };
+}
+
+} // namespace original
+
+
+const std::vector<std::string> COMMANDS = { "pend", "hist 10 alice", "chat bob", "quit", "hist 3 carol", "bogus cmd" };
+
+
+/**
+ * @brief Parses the command mix, returns millions of commands per second.
+**/
+template <typename F>
+auto run(F&& parse) -> double
+{
+    std::size_t acc = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0; i < ROUNDS; ++i) { acc += parse(COMMANDS[i % COMMANDS.size()]); }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // the result is used, so that parsing is not optimized out
+    if (acc == 0) { std::printf("\n"); }
+    return ROUNDS / elapsed / 1e6;
+}
+
+auto main() -> int
+{
+    auto before = run([](const std::string& input) -> std::size_t {
+        auto command = original::parse_command(input);
+        if (command == Command::CHAT) { return original::split_string(input)[1].size(); }
+        if (command == Command::HIST) { return original::parse_hist_command(input).first; }
+        return static_cast<std::size_t>(command);
+    });
+
+    auto after = run([](const std::string& input) -> std::size_t {
+        auto command = decode_text_command(input);
+        return static_cast<std::size_t>(command.command) + command.count + command.name.size();
+    });
+
+    std::printf("original parser %6.2f M commands/s\n", before);
+    std::printf("string_view     %6.2f M commands/s\n", after);
+
+    return 0;
+}
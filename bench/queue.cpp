@@ -0,0 +1,56 @@
+/**
+ * @file
+ *
+ * Microbenchmark of pending message queues, lock-free QueueStorage against
+ * mutex-based DequeStorage under 1-16 producers and a single consumer.
+**/
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "storage.hpp"
+
+
+constexpr std::size_t ITEMS = 1 << 21; // items pushed by all producers together
+
+
+/**
+ * @brief Consumer polls the queue as sessions do, returns millions of
+ *     items per second.
+**/
+template <typename Q>
+auto run(std::size_t producers) -> double
+{
+    Q queue;
+    std::vector<std::thread> threads;
+    auto per = ITEMS / producers;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (std::size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&]() {
+            for (std::size_t i = 0; i < per; ++i) { queue.push_back(Message("hello world message")); }
+        });
+    }
+
+    for (std::size_t got = 0; got < per * producers; ) {
+        if (queue.maybe_pop().has_value()) { ++got; }
+    }
+
+    for (auto&& thread : threads) { thread.join(); }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (per * producers) / elapsed / 1e6;
+}
+
+auto main() -> int
+{
+    for (std::size_t producers : { 1, 2, 4, 8, 16 }) {
+        std::printf(
+            "%2zu producers: mutex+deque %6.2f Mops/s, lock-free %6.2f Mops/s\n",
+            producers, run<DequeStorage<Message>>(producers), run<QueueStorage<Message>>(producers));
+    }
+
+    return 0;
+}
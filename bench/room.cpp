@@ -0,0 +1,69 @@
+/**
+ * @file
+ *
+ * Microbenchmark of room fan-out, Rooms::publish sharing one encoded
+ * message among all members against pushing a copy to each member.
+**/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "message.hpp"
+#include "room.hpp"
+
+
+constexpr std::size_t MESSAGE_SIZE = 100;
+constexpr std::size_t DELIVERIES = 1 << 21; // messages times members per room size
+
+
+/**
+ * @brief Nanoseconds per published message.
+**/
+template <typename F>
+auto measure(std::size_t messages, const std::vector<PendingDeque*>& queues, F&& publish) -> double
+{
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t k = 0; k < messages; ++k) { publish(k); }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto queue : queues) { while (queue->maybe_pop().has_value()) {} }
+    return elapsed / messages;
+}
+
+auto main() -> int
+{
+    const Message msg(MESSAGE_SIZE, 'x');
+    const UserId room = "#bench";
+
+    for (std::size_t members : { 10, 1000, 10000 }) {
+        UserMap users;
+        Rooms rooms;
+        std::vector<PendingDeque*> queues;
+
+        for (std::size_t i = 0; i < members; ++i) {
+            auto user = "u" + std::to_string(i);
+            auto&& queue = users.observe(user).get_pending().observe(room);
+            rooms.join(room, user, queue);
+            queues.push_back(&queue);
+        }
+
+        auto messages = std::max<std::size_t>(20, DELIVERIES / members);
+
+        auto shared = measure(messages, queues, [&](std::size_t) { rooms.publish(room, "sender", msg); });
+
+        // one body (and frame) per member, as pairwise chats would do
+        auto copied = measure(messages, queues, [&](std::size_t k) {
+            for (auto queue : queues) {
+                auto body = std::make_shared<const Message>("sender: " + msg);
+                queue->push_back(PendingMessage{ .id = k + 1, .body = body, .frame = std::make_shared<const Message>(encode_chat_frame(k + 1, *body)) });
+            }
+        });
+
+        std::printf(
+            "%5zu members: shared %10.0f ns/msg (%5.1f ns/member), copies %10.0f ns/msg (%5.1f ns/member)\n",
+            members, shared, shared / members, copied, copied / members);
+    }
+
+    return 0;
+}
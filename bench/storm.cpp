@@ -0,0 +1,194 @@
+/**
+ * @file
+ *
+ * Benchmark of connection acceptance under a reconnect storm. A server is
+ * forked into a child process, then 10k non-blocking clients connect at
+ * once and log in. Reports the rate of logged in clients and the latency
+ * from connect to the login reply for one and for several listeners
+ * (SO_REUSEPORT).
+ *
+ * Usage: cchat-bench-storm [port], each run uses the next port.
+**/
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "server_entity.hpp"
+#include "utility.hpp"
+
+
+constexpr std::size_t CLIENTS = 10'000;
+constexpr int64_t TIMEOUT = 30; // seconds until the storm is abandoned
+
+
+/**
+ * @brief Forks a server, returns once it listens.
+**/
+auto fork_server(const std::vector<std::string>& args) -> pid_t
+{
+    int ready[2];
+    if (pipe(ready) == -1) { throw std::runtime_error("Benchmark cannot create a pipe."); }
+
+    // the child would print buffered results again
+    std::fflush(stdout);
+
+    auto pid = fork();
+    if (pid == -1) { throw std::runtime_error("Benchmark cannot fork a server."); }
+
+    if (pid == 0) {
+        close(ready[0]);
+
+        std::vector<std::string> opts = { "cchat-server" };
+        opts.insert(opts.end(), args.begin(), args.end());
+
+        std::vector<char*> argv;
+        for (auto&& opt : opts) { argv.push_back(opt.data()); }
+
+        ServerArgsParser parser;
+        parser.parse(static_cast<int>(argv.size()), argv.data());
+
+        Server server;
+        server.init(parser);
+
+        // listening sockets accept connections as soon as init returns
+        char c = 0;
+        if (write(ready[1], &c, 1) != 1) { _exit(1); }
+        close(ready[1]);
+
+        server.loop();
+        _exit(0);
+    }
+
+    close(ready[1]);
+
+    char c;
+    auto cnt = read(ready[0], &c, 1);
+    close(ready[0]);
+
+    if (cnt != 1) { throw std::runtime_error("Forked server has not started."); }
+    return pid;
+}
+
+auto storm(uint16_t port, const std::string& mode, std::size_t listeners, const std::string& log) -> void
+{
+    auto pid = fork_server({
+        "--port=" + std::to_string(port), "--mode=" + mode, "--listeners=" + std::to_string(listeners), "--log-file=" + log
+    });
+
+    struct Client
+    {
+        int sock = -1;
+        std::chrono::steady_clock::time_point start;
+        std::string recv;
+        bool sent = false;
+        bool done = false;
+    };
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    auto epoll = epoll_create1(0);
+    std::vector<Client> clients(CLIENTS);
+    std::vector<double> latencies;
+    std::size_t failed = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    // all connects are issued before any reply is read
+    for (std::size_t i = 0; i < CLIENTS; ++i) {
+        auto&& client = clients[i];
+        client.sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        client.start = std::chrono::steady_clock::now();
+        connect(client.sock, (sockaddr *)&addr, sizeof(addr));
+
+        epoll_event event{ .events = EPOLLIN | EPOLLOUT, .data = { .u64 = i } };
+        epoll_ctl(epoll, EPOLL_CTL_ADD, client.sock, &event);
+    }
+
+    std::vector<epoll_event> events(256);
+
+    while (latencies.size() + failed < CLIENTS && std::chrono::steady_clock::now() - start < std::chrono::seconds(TIMEOUT)) {
+        auto cnt = epoll_wait(epoll, events.data(), static_cast<int>(events.size()), 100);
+
+        for (int e = 0; e < cnt; ++e) {
+            auto&& client = clients[events[e].data.u64];
+            if (client.done) { continue; }
+
+            // refused or reset connection
+            if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+                client.done = true;
+                ++failed;
+                epoll_ctl(epoll, EPOLL_CTL_DEL, client.sock, nullptr);
+                continue;
+            }
+
+            // connected, the log in is one packet with the user name
+            if (!client.sent && (events[e].events & EPOLLOUT)) {
+                auto name = "u" + std::to_string(events[e].data.u64);
+                uint32_t len = htonl(name.size());
+                std::string packet(reinterpret_cast<const char*>(&len), sizeof(len));
+                packet.append(name);
+
+                client.sent = write(client.sock, packet.data(), packet.size()) == static_cast<ssize_t>(packet.size());
+
+                epoll_event event{ .events = EPOLLIN, .data = events[e].data };
+                epoll_ctl(epoll, EPOLL_CTL_MOD, client.sock, &event);
+            }
+
+            // any complete reply header means the server has served the log in
+            if (events[e].events & EPOLLIN) {
+                char buf[256];
+                auto got = read(client.sock, buf, sizeof(buf));
+                if (got > 0) { client.recv.append(buf, got); }
+
+                if (client.sent && client.recv.size() >= sizeof(uint32_t)) {
+                    client.done = true;
+                    latencies.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - client.start).count());
+                    epoll_ctl(epoll, EPOLL_CTL_DEL, client.sock, nullptr);
+                }
+            }
+        }
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto&& client : clients) { close(client.sock); }
+    close(epoll);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+
+    std::error_code ec;
+    std::filesystem::remove(log, ec);
+
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&](std::size_t pct) { return latencies.empty() ? 0.0 : latencies[latencies.size() * pct / 100]; };
+
+    std::printf(
+        "%-7s %zu listener(s): %5zu/%zu logged in (%zu failed) in %5.2f s, %7.0f conn/s, login p50 %6.1f ms, p99 %6.1f ms\n",
+        mode.c_str(), listeners, latencies.size(), CLIENTS, failed, elapsed, latencies.size() / elapsed, at(50), at(99));
+}
+
+auto main(int argc, char* argv[]) -> int
+{
+    uint16_t port = (argc > 1) ? (parse_port(argv[1])) : (25000);
+    std::string log = (std::filesystem::temp_directory_path() / "cchat-bench-storm.log").string();
+
+    for (auto&& mode : { "reactor", "uring" }) {
+        for (std::size_t listeners : { 1, 4 }) { storm(port++, mode, listeners, log); }
+    }
+
+    return 0;
+}
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <exception>
 #include <iostream>
+#include <thread>
+#include <sys/socket.h>
 #include "args.hpp"
 
 
@@ -68,8 +71,34 @@ auto ServerArgsParser::parse(int argc, char **argv) -> void
 {
     const struct option optv[] {
         { .name="port", .has_arg=required_argument, .flag=nullptr, .val=(int)'p' },
+        { .name="mode", .has_arg=required_argument, .flag=nullptr, .val=(int)'m' },
+        { .name="workers", .has_arg=required_argument, .flag=nullptr, .val=(int)'w' },
+        { .name="retention", .has_arg=required_argument, .flag=nullptr, .val=(int)'r' },
+        { .name="history-dir", .has_arg=required_argument, .flag=nullptr, .val=(int)'d' },
+        { .name="pending-dir", .has_arg=required_argument, .flag=nullptr, .val=(int)'q' },
+        { .name="log-file", .has_arg=required_argument, .flag=nullptr, .val=(int)'l' },
+        { .name="log-rotate-size", .has_arg=required_argument, .flag=nullptr, .val=(int)'s' },
+        { .name="log-rotate-time", .has_arg=required_argument, .flag=nullptr, .val=(int)'t' },
+        { .name="log-sync", .has_arg=required_argument, .flag=nullptr, .val=(int)'y' },
+        { .name="max-packet", .has_arg=required_argument, .flag=nullptr, .val=(int)'x' },
+        { .name="listeners", .has_arg=required_argument, .flag=nullptr, .val=(int)'n' },
+        { .name="backlog", .has_arg=required_argument, .flag=nullptr, .val=(int)'b' },
         { 0, 0, 0, 0 }
     };
 
-    parse_specific(argc, argv, 1, optv);
+    // optional options are pre-filled with default values
+    opts_["mode"] = "thread";
+    opts_["workers"] = std::to_string(std::max(1U, std::thread::hardware_concurrency()));
+    opts_["retention"] = "1000";
+    opts_["history-dir"] = "";
+    opts_["pending-dir"] = "";
+    opts_["log-file"] = "";
+    opts_["log-rotate-size"] = std::to_string(64 << 20);
+    opts_["log-rotate-time"] = "86400";
+    opts_["log-sync"] = "";
+    opts_["max-packet"] = std::to_string(1 << 20);
+    opts_["listeners"] = "1";
+    opts_["backlog"] = std::to_string(SOMAXCONN);
+
+    parse_specific(argc, argv, 13, optv);
 }
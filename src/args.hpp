@@ -59,7 +59,21 @@ class ServerArgsParser final : public ArgsParser
 {
 public:
     /**
-     * @brief Server-specific parse recognizes --port.
+     * @brief Server-specific parse recognizes --port, optional --mode
+     *     (@b thread, @b reactor, @b uring, @b shard or @b coro), optional
+     *     --workers (number of event-loop threads in all but @b thread
+     *     mode), optional
+     *     --retention
+     *     (number of history messages kept per conversation), optional
+     *     --history-dir (history is persisted if set), optional
+     *     --pending-dir (undelivered messages are journaled if set) and
+     *     optional --log-file (log goes to a rotating file if set) with
+     *     --log-rotate-size (bytes), --log-rotate-time (seconds) and
+     *     --log-sync (fdatasync period in ms, disabled if not set),
+     *     optional --max-packet (bytes of the largest accepted packet),
+     *     optional --listeners (number of listening sockets sharing the
+     *     port, each with its own accept loop) and optional --backlog
+     *     (length of the accept queue of each listening socket).
     **/
     void parse(int argc, char **argv) override;
 };
@@ -39,6 +39,7 @@ auto Client::init(const ClientArgsParser& args) -> void
 
     // unblock AFTER connect!
     set_socket_non_blocking(*sock_);
+    set_socket_no_delay(*sock_);
 
     std::cout
         << "Client has established connection as "
@@ -4,7 +4,7 @@
 #include "client_gui.hpp"
 
 
-Gui::Gui(Panel& panel, PendingDeque& send_stor, PendingDeque& recv_stor)
+Gui::Gui(Panel& panel, MessageDeque& send_stor, MessageDeque& recv_stor)
     : panel_(panel), buff_stor_(), send_stor_(send_stor), recv_stor_(recv_stor)
 {
 }
@@ -54,7 +54,7 @@ auto Gui::draw_window(int rows, const char* buf) -> void
     refresh();
 }
 
-auto Gui::loop(std::atomic_bool& done) -> void
+auto Gui::loop(WakeupFlag& done) -> void
 {
     WINDOW *w;
 
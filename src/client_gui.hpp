@@ -10,6 +10,7 @@
 #include <atomic>
 #include <deque>
 #include <string>
+#include "flag.hpp"
 #include "logger.hpp"
 #include "storage.hpp"
 
@@ -29,8 +30,8 @@ private:
 
     Panel& panel_;
     MsgBuffer buff_stor_;
-    PendingDeque& send_stor_;
-    PendingDeque& recv_stor_;
+    MessageDeque& send_stor_;
+    MessageDeque& recv_stor_;
 
     /**
      * @brief Try fetch message from receive storage and put it to buffer.
@@ -50,7 +51,7 @@ public:
      * @note Gui sends messages outside via @b send_stor .
      *     Gui receive messages from outside via @b recv_stor .
     **/
-    Gui(Panel& panel, PendingDeque& send_stor, PendingDeque& recv_stor);
+    Gui(Panel& panel, MessageDeque& send_stor, MessageDeque& recv_stor);
 
     /**
      * @brief Draws the interface in an infinite loop and gets
@@ -59,7 +60,7 @@ public:
      * @note The routine (cycle) is blocking and explicit @b wait_for
      *     is not necessary.
     **/
-    void loop(std::atomic_bool& done);
+    void loop(WakeupFlag& done);
 
     Gui(Gui&& gui) = delete;
     Gui(const Gui& gui) = delete;
@@ -3,18 +3,19 @@
 #include "client_gui.hpp"
 #include "client_session.hpp"
 #include "message.hpp"
+#include "utility.hpp"
 
 
 constexpr int64_t GUI_STORAGE_RATE = 100;
 
 
-auto recv_gui_message(std::atomic_bool& done, PendingDeque& recv_gui) -> std::optional<Message>
+auto recv_gui_message(WakeupFlag& done, MessageDeque& recv_gui) -> std::optional<Message>
 {
     std::optional<Message> result;
 
-    while (!done.load() && !result.has_value()) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(GUI_STORAGE_RATE));
-        result = recv_gui.maybe_pop();
+    // wake up on push, periodically check if done
+    while (!done.load() && !(result = recv_gui.maybe_pop()).has_value()) {
+        recv_gui.wait_for(done, std::chrono::milliseconds(GUI_STORAGE_RATE));
     }
 
     return result;
@@ -22,7 +23,7 @@ auto recv_gui_message(std::atomic_bool& done, PendingDeque& recv_gui) -> std::op
 
 
 ClientSession::ClientSession(int sock, std::string&& name)
-    : Session(sock), name_(std::move(name)), send_gui_(), recv_gui_()
+    : Session(sock), name_(std::move(name)), opponent_(), request_id_(0), send_gui_(), recv_gui_(), last_ids_()
 {
 }
 
@@ -33,23 +34,47 @@ auto ClientSession::command_help() -> void
         "hist # user_name: receive up to 10 last messages with the user.",
         "chat user_name: opens chat with a user, user could be offline.",
         "     Enter <$> to escape chat.",
-        "pend: shows users with messages waiting to be delivered.",
+        "join #room_name: receive messages of the room, chat #room_name joins as well.",
+        "leave #room_name: stop receiving messages of the room.",
+        "pend: shows users and rooms with the number of messages waiting to be delivered.",
         "quit: exits the program."
     };
 
     for (auto&& message : messages) { send_gui_.push_back(message); }
 }
 
-auto ClientSession::recv_sequence() -> void
+auto ClientSession::show_chunk(std::string_view body, bool room, std::map<std::string, std::string, std::less<>>& partials) -> void
 {
-    bool bit;
-    std::optional<Message> msg;
-
-    do {
-        msg = recv_with_maybe_fail();
-        bit = msg.has_value() && (*msg != TERMINATION_SYMBOL);
-        if (bit) { send_gui_.push_back(*msg); }
-    } while (bit);
+    auto chunk = body.starts_with(CHUNK_SYMBOL);
+    if (chunk) { body.remove_prefix(std::size(CHUNK_SYMBOL) - 1); }
+
+    // chunks of room members may interleave, they are joined per sender
+    std::string_view sender;
+    if (!room || !decode_room_message(body, sender, body)) { sender = { }; }
+
+    auto it = partials.try_emplace(std::string(sender)).first;
+    it->second.append(body);
+    if (chunk) { return; }
+
+    send_gui_.push_back((room && !sender.empty()) ? (it->first + ": " + it->second) : (std::move(it->second)));
+    partials.erase(it);
+}
+
+auto ClientSession::request(const std::string& command) -> void
+{
+    auto id = ++request_id_;
+    send_with_maybe_fail(tag_binary_command(id, command));
+
+    auto msg = recv_with_maybe_fail();
+    uint64_t response_id;
+    std::vector<std::string_view> items;
+
+    if (!msg.has_value() || !decode_tagged_response(*msg, response_id, items) || response_id != id) {
+        done_.store(true);
+        return;
+    }
+
+    for (auto&& item : items) { send_gui_.push_back(Message(item)); }
 }
 
 auto ClientSession::serve() -> void
@@ -67,10 +92,12 @@ auto ClientSession::serve() -> void
         {
         case ClientMode::LOG_IN:
         {
-            send_with_maybe_fail(name_);
+            // binary commands and acknowledgements are requested by tags
+            auto tagged = name_ + BINARY_PROTOCOL_TAG + ACK_PROTOCOL_TAG;
+            send_with_maybe_fail(tagged);
             auto resp = recv_with_maybe_fail();
 
-            if (done_.load() || (*resp != name_)) {
+            if (done_.load() || (*resp != tagged)) {
                 std::cout
                     << "Log in as "
                     << name_
@@ -103,25 +130,37 @@ auto ClientSession::serve() -> void
             }
             break;
             case Command::PEND:
+            {
+                request(encode_binary_command(Command::PEND));
+            }
+            break;
             case Command::HIST:
             {
-                send_with_maybe_fail(*maybe_msg);
-                recv_sequence();
+                auto [n, opponent] = parse_hist_command(*maybe_msg);
+                request(encode_binary_command(Command::HIST, n, opponent));
+            }
+            break;
+            case Command::JOIN:
+            case Command::LEAVE:
+            {
+                auto command = decode_text_command(*maybe_msg);
+                request(encode_binary_command(command.command, 0, command.name));
             }
             break;
             case Command::QUIT:
             {
-                send_with_maybe_fail(*maybe_msg);
+                send_with_maybe_fail(encode_binary_command(Command::QUIT));
                 done_.store(true);
             }
             break;
             case Command::CHAT:
             {
-                auto chat_opponent = parse_chat_command(*maybe_msg);
-                send_with_maybe_fail(*maybe_msg);
+                // chat is resumed after the last received message
+                opponent_ = parse_chat_command(*maybe_msg);
+                send_with_maybe_fail(encode_binary_command(Command::CHAT, 0, opponent_, last_ids_[opponent_]));
                 auto resp = recv_with_maybe_fail();
 
-                if (resp.has_value() && (*resp == chat_opponent)) {
+                if (resp.has_value() && (*resp == opponent_)) {
                     panel.store(panel.load() + " with " + (*resp));
                 }
 
@@ -143,14 +182,28 @@ auto ClientSession::serve() -> void
         break;
         case ClientMode::CHAT:
         {
-            std::atomic_bool chat_done(false);
+            WakeupFlag chat_done(false);
+            std::mutex send_mutex;
+            auto&& last_id = last_ids_[opponent_];
+            auto room = is_room_name_valid(opponent_);
 
-            // receive messages
+            // receive messages, acknowledge each one, duplicates are skipped
             std::thread t([&]() {
+                uint64_t id;
+                std::string_view body;
+                std::map<std::string, std::string, std::less<>> partials;
+
                 while (!chat_done.load()) {
-                    auto msg = RecvConnect(sock_, chat_done).recv_maybe_message();
-                    if (!chat_done.load() && msg.has_value()) {
-                        send_gui_.push_back(std::move(*msg));
+                    auto msg = RecvConnect(sock_, recv_buffer_, chat_done).recv_maybe_message();
+                    if (!chat_done.load() && msg.has_value() && decode_chat_frame(*msg, id, body)) {
+                        if (id > last_id) {
+                            last_id = id;
+                            show_chunk(body, room, partials);
+                        }
+
+                        // acknowledgement shall not follow end of chat
+                        std::lock_guard lock(send_mutex);
+                        if (!chat_done.load()) { SendConnect(sock_, chat_done).try_send_message(ACK_SYMBOL + std::to_string(id)); }
                     }
                     chat_done.store(chat_done.load() || !msg.has_value());
                 }
@@ -164,7 +217,10 @@ auto ClientSession::serve() -> void
                         *msg = "[" + name_ + "] " + *msg;
                     }
                     send_gui_.push_back(*msg);
-                    chat_done.store(!SendConnect(sock_, chat_done).try_send_message(*msg) || (*msg == END_OF_CHAT_SYMBOL));
+
+                    // long messages go out in chunks
+                    std::lock_guard lock(send_mutex);
+                    chat_done.store(!SendConnect(sock_, chat_done).try_send_messages(split_chunks(*msg, MAX_CHUNK_SIZE, CHUNK_SYMBOL)) || (*msg == END_OF_CHAT_SYMBOL));
                 }
             }
 
@@ -7,6 +7,10 @@
  *
  * This header file declares ClientSession class.
 **/
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
 #include "logger.hpp"
 #include "session.hpp"
 
@@ -15,8 +19,16 @@ class ClientSession final : public Session
 {
 private:
     std::string name_;
-    PendingDeque send_gui_;
-    PendingDeque recv_gui_;
+    std::string opponent_;
+    uint64_t request_id_;
+    MessageDeque send_gui_;
+    MessageDeque recv_gui_;
+
+    /**
+     * @brief Id of the last message received from each opponent, chats
+     *     are resumed from these ids.
+    **/
+    std::map<std::string, uint64_t> last_ids_;
 
     /**
      * @brief Send help messages to user Gui.
@@ -24,10 +36,16 @@ private:
     void command_help();
 
     /**
-     * @brief Receives list of users with pending messages on the Server.
-     *     End of sequences is reported by the Server using special token.
+     * @brief Sends tagged command and passes items of the response to
+     *     user Gui, the response shall carry the same request id.
+    **/
+    void request(const std::string& command);
+
+    /**
+     * @brief Joins chunk @b body of a chat message to its partial message
+     *     (per sender in rooms), complete messages are passed to user Gui.
     **/
-    void recv_sequence();
+    void show_chunk(std::string_view body, bool room, std::map<std::string, std::string, std::less<>>& partials);
 
 public:
     ClientSession(int sock, std::string&& name);
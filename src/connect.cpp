@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <memory>
+#include <poll.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include "connect.hpp"
@@ -16,136 +20,346 @@ auto is_unrecoverable_error() -> bool
 
 
 /**
- * @brief Checks if blocking error appeared.
+ * @brief Blocks until the socket is ready for @b events or the flag is set.
  *
- * @note Blocking error is either @b EWOULDBLOCK or @b EAGAIN .
+ * @return True if the socket is ready (or broken), False upon cancellation.
 **/
-auto is_blocking_error() -> bool
+auto wait_ready(int sock, short events, const WakeupFlag& done) -> bool
 {
-    return errno == EWOULDBLOCK || errno == EAGAIN;
+    // fallback period if the flag cannot provide descriptor
+    constexpr int RECOVERY_TIMEOUT = 50;
+
+    auto fd = done.get_fd();
+    pollfd fds[2] {
+        { .fd = sock, .events = events, .revents = 0 },
+        { .fd = fd, .events = POLLIN, .revents = 0 }
+    };
+
+    for (;;) {
+        auto res = poll(fds, 2, (fd == -1) ? RECOVERY_TIMEOUT : -1);
+
+        if (res == -1 && errno == EINTR) { continue; }
+        if (res == -1 || done.load()) { return false; }
+        if (res > 0 || fd == -1) { return true; }
+    }
 }
 
 
-SendConnect::SendConnect(int sock, const std::atomic_bool& done)
+SendConnect::SendConnect(int sock, const WakeupFlag& done)
     : sock_(sock), done_(done)
 {
 }
 
-auto SendConnect::try_send_buffer(const uint8_t* buf, std::size_t len) -> bool
+auto SendConnect::try_send_iovec(iovec* iov, std::size_t cnt) -> bool
 {
-    constexpr int64_t SEND_RECOVERY_TIMEOUT = 50;
-    std::size_t idx = 0;
-
-    while (!done_.load() && idx < len) {
-        auto cnt = send(sock_, buf, len - idx, 0);
+    while (!done_.load() && cnt > 0) {
+        msghdr hdr {};
+        hdr.msg_iov = iov;
+        hdr.msg_iovlen = std::min<std::size_t>(cnt, IOV_MAX);
+
+        auto res = sendmsg(sock_, &hdr, MSG_NOSIGNAL);
+
+        if (res >= 0) {
+            auto len = static_cast<std::size_t>(res);
+
+            // skip fully sent buffers, continue partially sent one
+            while (cnt > 0 && len >= iov->iov_len) {
+                len -= iov->iov_len;
+                ++iov; --cnt;
+            }
+            if (cnt > 0) {
+                iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + len;
+                iov->iov_len -= len;
+            }
+            continue;
+        }
 
         // nothing is sent and errno is unrecoverable
-        if (cnt == -1 && is_unrecoverable_error()) { break; }
+        if (is_unrecoverable_error()) { break; }
 
-        // sent no bytes or bytes less than expected, cnt is either -1 or >=0
-        if ((cnt == -1 || (static_cast<size_t>(cnt) < (len - idx))) && is_blocking_error()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(SEND_RECOVERY_TIMEOUT));
-        }
-
-        if (cnt > 0) { idx += cnt; buf += cnt; }
+        // socket buffer is full, wait until writable or cancelled
+        if (!wait_ready(sock_, POLLOUT, done_)) { break; }
     }
 
-    return idx == len;
+    return cnt == 0;
 }
 
-auto SendConnect::try_send_header(const std::string& msg) -> bool
+auto SendConnect::try_send_message(const Message& msg) -> bool
 {
-    auto len = sizeof(uint32_t);
-    auto hdr = static_cast<uint32_t>(msg.size());
+    uint32_t hdr = htonl(static_cast<uint32_t>(msg.size())); // host-to-network byte order!
 
-    uint32_t buf[1] { htonl(hdr) }; // host-to-network byte order!
+    iovec iov[2] {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = const_cast<char*>(msg.data()), .iov_len = msg.size() }
+    };
 
-    return
-        try_send_buffer(reinterpret_cast<const uint8_t*>(buf), len);
+    return try_send_iovec(iov, 2);
 }
 
-auto SendConnect::try_send_body(const std::string& msg) -> bool
+template <typename Range, typename Deref>
+auto SendConnect::try_send_range(const Range& msgs, Deref deref) -> bool
 {
-    return
-        try_send_buffer(reinterpret_cast<const uint8_t*>(msg.c_str()), msg.size());
+    std::vector<uint32_t> hdrs;
+    std::vector<iovec> iov;
+
+    hdrs.reserve(msgs.size());
+    iov.reserve(2 * msgs.size());
+
+    for (auto&& item : msgs) {
+        const Message& msg = deref(item);
+        hdrs.push_back(htonl(static_cast<uint32_t>(msg.size()))); // host-to-network byte order!
+        iov.push_back({ .iov_base = &hdrs.back(), .iov_len = sizeof(uint32_t) });
+        iov.push_back({ .iov_base = const_cast<char*>(msg.data()), .iov_len = msg.size() });
+    }
+
+    return try_send_iovec(iov.data(), iov.size());
 }
 
-auto SendConnect::try_send_message(const Message& msg) -> bool
+auto SendConnect::try_send_messages(const std::vector<Message>& msgs) -> bool
 {
-    auto result = true;
-
-    if (result) { result = try_send_header(msg); }
-    if (result) { result = try_send_body(msg); }
+    return try_send_range(msgs, [](const Message& msg) -> const Message& { return msg; });
+}
 
-    return result;
+auto SendConnect::try_send_messages(const std::vector<MessageRef>& msgs) -> bool
+{
+    return try_send_range(msgs, [](const MessageRef& msg) -> const Message& { return *msg; });
 }
 
 
-RecvConnect::RecvConnect(int sock, const std::atomic_bool& done)
-    : sock_(sock), done_(done)
+SendQueue::SendQueue()
+    : queue_(), iov_(), offset_(0), depth_(0)
 {
 }
 
-auto RecvConnect::try_recv_buffer(std::unique_ptr<uint8_t*>& buf, std::size_t len) -> bool
+auto SendQueue::push(MessageRef msg) -> void
 {
-    constexpr int64_t RECV_RECOVERY_TIMEOUT = 50;
-    std::size_t idx = 0;
+    auto hdr = htonl(static_cast<uint32_t>(msg->size())); // host-to-network byte order!
+    depth_ += sizeof(hdr) + msg->size();
+    queue_.push_back(Entry{ .hdr = hdr, .msg = std::move(msg) });
+}
 
-    while (!done_.load() && idx < len) {
-        auto cnt = recv(sock_, *buf + idx, len - idx, 0);
+auto SendQueue::depth() const -> std::size_t
+{
+    return depth_;
+}
 
-        // nothing is received and error is unrecoverable
-        if (cnt == -1 && is_unrecoverable_error()) { break; }
+auto SendQueue::empty() const -> bool
+{
+    return depth_ == 0;
+}
 
-        // received no bytes or bytes less than expected, cnt is either -1 or >=0
-        if ((cnt == -1 || (static_cast<size_t>(cnt) < (len - idx))) && is_blocking_error()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(RECV_RECOVERY_TIMEOUT));
-        }
+auto SendQueue::gather() -> std::span<iovec>
+{
+    iov_.clear();
+
+    // header and body of each packet
+    for (auto it = queue_.begin(); it != queue_.end() && iov_.size() + 2 <= IOV_MAX; ++it) {
+        iov_.push_back({ .iov_base = &it->hdr, .iov_len = sizeof(it->hdr) });
+        iov_.push_back({ .iov_base = const_cast<char*>(it->msg->data()), .iov_len = it->msg->size() });
+    }
 
-        if (cnt > 0) { idx += cnt; }
+    // skip already sent bytes of the front packet
+    for (auto skip = offset_, i = std::size_t(0); skip > 0; ++i) {
+        auto len = std::min(skip, iov_[i].iov_len);
+        iov_[i].iov_base = static_cast<uint8_t*>(iov_[i].iov_base) + len;
+        iov_[i].iov_len -= len;
+        skip -= len;
     }
 
-    return idx == len;
+    return iov_;
 }
 
-auto RecvConnect::recv_maybe_header() -> std::optional<std::size_t>
+auto SendQueue::advance(std::size_t len) -> void
 {
-    std::optional<std::size_t> header;
+    depth_ -= len;
+    len += offset_;
 
-    auto len = sizeof(uint32_t);
-    auto hdr = std::make_unique<uint8_t*>(new uint8_t[len]);
+    // pop fully sent packets, remember the progress of the partial one
+    while (!queue_.empty() && len >= sizeof(uint32_t) + queue_.front().msg->size()) {
+        len -= sizeof(uint32_t) + queue_.front().msg->size();
+        queue_.pop_front();
+    }
+    offset_ = len;
+}
 
-    if (try_recv_buffer(hdr, len)) {
-        auto size = ntohl(reinterpret_cast<uint32_t *>(*hdr)[0]); // network-to-host byte order!
-        if (size != 0) {
-            header = static_cast<std::size_t>(size);
-        }
+auto SendQueue::write(int sock) -> bool
+{
+    while (!queue_.empty()) {
+        auto iov = gather();
+
+        msghdr hdr {};
+        hdr.msg_iov = iov.data();
+        hdr.msg_iovlen = iov.size();
+
+        auto res = sendmsg(sock, &hdr, MSG_NOSIGNAL);
+
+        if (res == -1) { return !is_unrecoverable_error(); }
+
+        advance(res);
     }
 
-    return header;
+    return true;
+}
+
+auto SendQueue::drain(int sock, const WakeupFlag& cancel) -> bool
+{
+    while (write(sock) && !empty() && wait_ready(sock, POLLOUT, cancel)) { }
+    return empty();
+}
+
+
+RecvBuffer::RecvBuffer()
+    : data_(std::make_unique<uint8_t[]>(DEFAULT_CAPACITY)), capacity_(DEFAULT_CAPACITY), head_(0), tail_(0), oversized_(0)
+{
+}
+
+auto RecvBuffer::set_max_packet(std::size_t max_packet) -> void
+{
+    max_packet_.store(max_packet);
+}
+
+auto RecvBuffer::copy_out(std::size_t pos, uint8_t* dst, std::size_t len) const -> void
+{
+    auto beg = pos & (capacity_ - 1);
+    auto fst = std::min(len, capacity_ - beg);
+
+    std::memcpy(dst, data_.get() + beg, fst);
+    std::memcpy(dst + fst, data_.get(), len - fst);
+}
+
+auto RecvBuffer::reserve(std::size_t len) -> void
+{
+    if (len <= capacity_) { return; }
+
+    auto capacity = capacity_;
+    while (capacity < len) { capacity *= 2; }
+
+    auto data = std::make_unique<uint8_t[]>(capacity);
+    copy_out(head_, data.get(), size());
+
+    tail_ = size();
+    head_ = 0;
+    capacity_ = capacity;
+    data_ = std::move(data);
+}
+
+auto RecvBuffer::size() const -> std::size_t
+{
+    return tail_ - head_;
+}
+
+auto RecvBuffer::oversized() const -> std::size_t
+{
+    return oversized_;
 }
 
-auto RecvConnect::recv_maybe_body(std::size_t len) -> std::optional<Message>
+auto RecvBuffer::append(const uint8_t* data, std::size_t len) -> void
+{
+    reserve(size() + len);
+
+    auto beg = tail_ & (capacity_ - 1);
+    auto fst = std::min(len, capacity_ - beg);
+
+    std::memcpy(data_.get() + beg, data, fst);
+    std::memcpy(data_.get(), data + fst, len - fst);
+    tail_ += len;
+}
+
+auto RecvBuffer::take() -> std::string
+{
+    std::string result(size(), '\0');
+    copy_out(head_, reinterpret_cast<uint8_t*>(result.data()), result.size());
+    head_ = tail_;
+
+    return result;
+}
+
+auto RecvBuffer::fill(int sock) -> ssize_t
+{
+    // buffer is full, i.e. a single packet is larger than capacity
+    if (size() == capacity_) { reserve(2 * capacity_); }
+
+    auto beg = tail_ & (capacity_ - 1);
+    auto free = capacity_ - size();
+    auto fst = std::min(free, capacity_ - beg);
+
+    iovec iov[2] {
+        { .iov_base = data_.get() + beg, .iov_len = fst },
+        { .iov_base = data_.get(), .iov_len = free - fst }
+    };
+
+    auto cnt = readv(sock, iov, (free > fst) ? 2 : 1);
+    if (cnt > 0) { tail_ += cnt; }
+
+    return cnt;
+}
+
+auto RecvBuffer::maybe_decode() -> std::optional<Message>
 {
     std::optional<Message> result;
-    auto hdr = std::make_unique<uint8_t*>(new uint8_t[len]);
+    constexpr auto HEADER_SIZE = sizeof(uint32_t);
 
-    if (try_recv_buffer(hdr, len)) {
-        result.emplace();
-        for (std::size_t i = 0; i < len; ++i) {
-            result->push_back(static_cast<char>((*hdr)[i]));
-        }
+    if (oversized_ > 0 || size() < HEADER_SIZE) { return result; }
+
+    uint32_t hdr;
+    copy_out(head_, reinterpret_cast<uint8_t*>(&hdr), HEADER_SIZE);
+    auto len = static_cast<std::size_t>(ntohl(hdr)); // network-to-host byte order!
+
+    // the length is untrusted, nothing is allocated for it
+    if (len > max_packet_.load(std::memory_order_relaxed)) {
+        oversized_ = len;
+        return result;
+    }
+
+    // make sure the whole packet fits into the buffer
+    if (size() < HEADER_SIZE + len) {
+        reserve(HEADER_SIZE + len);
+        return result;
     }
 
+    auto beg = (head_ + HEADER_SIZE) & (capacity_ - 1);
+    auto fst = std::min(len, capacity_ - beg);
+    auto ptr = reinterpret_cast<const char*>(data_.get());
+
+    result.emplace();
+    result->reserve(len);
+    result->append(ptr + beg, fst);
+    result->append(ptr, len - fst);
+
+    head_ += HEADER_SIZE + len;
+
+    // rewind positions to keep writes contiguous as long as possible
+    if (head_ == tail_) { head_ = tail_ = 0; }
+
     return result;
 }
 
+
+RecvConnect::RecvConnect(int sock, RecvBuffer& buffer, const WakeupFlag& done)
+    : sock_(sock), buffer_(buffer), done_(done)
+{
+}
+
 auto RecvConnect::recv_maybe_message() -> std::optional<Message>
 {
     std::optional<Message> result;
 
-    auto header = recv_maybe_header();
-    if (header.has_value()) { result = recv_maybe_body(*header); }
+    while (!done_.load() && !(result = buffer_.maybe_decode()).has_value()) {
+        if (buffer_.oversized() > 0) { break; }
+
+        auto cnt = buffer_.fill(sock_);
+
+        if (cnt > 0) { continue; }
+
+        // peer has closed the connection or errno is unrecoverable
+        if (cnt == 0 || is_unrecoverable_error()) { break; }
+
+        // nothing to read, wait until readable or cancelled
+        if (!wait_ready(sock_, POLLIN, done_)) { break; }
+    }
+
+    // empty body is not a valid packet
+    if (result.has_value() && result->empty()) { result.reset(); }
 
     return result;
 }
@@ -3,8 +3,14 @@
 
 
 #include <atomic>
+#include <deque>
 #include <memory>
 #include <queue>
+#include <span>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include "flag.hpp"
 #include "logger.hpp"
 #include "storage.hpp"
 
@@ -13,65 +19,226 @@ class SendConnect final
 {
 private:
     int sock_;
-    const std::atomic_bool& done_;
+    const WakeupFlag& done_;
 
     /**
-     * @brief Sends passed buffer via non-blocking socket.
-    **/
-    bool try_send_buffer(const uint8_t* buf, std::size_t len);
-
-    /**
-     * @brief Generate header of a message and sends.
-     *     Currently, header is equal to the length of a message.
+     * @brief Sends passed buffers by gather writes via non-blocking socket.
+     *     Partially sent buffers are continued. Blocks until the socket is
+     *     writable or @b done_ is set.
+     *
+     * @note Passed vectors are modified!
     **/
-    bool try_send_header(const std::string& msg);
+    bool try_send_iovec(iovec* iov, std::size_t cnt);
 
     /**
-     * @brief Sends char-by-char body of a message.
+     * @brief Builds header and body vectors for each message and sends.
     **/
-    bool try_send_body(const std::string& msg);
+    template <typename Range, typename Deref>
+    bool try_send_range(const Range& msgs, Deref deref);
 
 public:
-    SendConnect(int sock, const std::atomic_bool& done);
+    SendConnect(int sock, const WakeupFlag& done);
 
     /**
-     * @brief Send a message.
+     * @brief Send a message, header (length of a message) and body go out
+     *     by one system call.
      *
      * @return True upon success, otherwise False.
     **/
     bool try_send_message(const Message& msg);
+
+    /**
+     * @brief Send a batch of messages, all headers and bodies go out by
+     *     as few system calls as possible.
+     *
+     * @return True upon success, otherwise False.
+    **/
+    bool try_send_messages(const std::vector<Message>& msgs);
+
+    /**
+     * @brief Send a batch of shared messages, see above.
+    **/
+    bool try_send_messages(const std::vector<MessageRef>& msgs);
 };
 
 
-class RecvConnect final
+/**
+ * @brief Per-connection queue of outbound packets. Queued packets are
+ *     coalesced, i.e. written by gather writes of as many packets as the
+ *     socket accepts, bodies are never copied. The number of queued bytes
+ *     (depth) drives flushing and backpressure decisions of the owner.
+**/
+class SendQueue final
 {
 private:
-    int sock_;
-    const std::atomic_bool& done_;
+    struct Entry
+    {
+        uint32_t hdr;
+        MessageRef msg;
+    };
+
+    std::deque<Entry> queue_;
+    std::vector<iovec> iov_;
+    std::size_t offset_;
+    std::size_t depth_;
+
+public:
 
     /**
-     * @brief Receives exactly @b len number of raw bytes.
+     * @brief Depth worth flushing before the end of the turn.
+    **/
+    static constexpr std::size_t FLUSH_THRESHOLD = 64 << 10;
+
+    /**
+     * @brief Event loops stop reading above, resume below half.
+    **/
+    static constexpr std::size_t MAX_DEPTH = 4 << 20;
+
+    SendQueue();
+
+    void push(MessageRef msg);
+
+    /**
+     * @brief Number of queued bytes (headers included) not sent yet.
+    **/
+    std::size_t depth() const;
+
+    bool empty() const;
+
+    /**
+     * @brief Buffers of queued packets (header and body each) for one
+     *     gather write, the front packet without already sent bytes. Buffers
+     *     stay valid until the next @b gather .
+    **/
+    std::span<iovec> gather();
+
+    /**
+     * @brief Removes @b len sent bytes from the front of the queue.
+    **/
+    void advance(std::size_t len);
+
+    /**
+     * @brief Writes queued packets until the socket would block, the front
+     *     packet could be sent partially.
      *
-     * @note Socket shall be configured as non-blocking.
+     * @return False upon unrecoverable error.
     **/
-    bool try_recv_buffer(std::unique_ptr<uint8_t*>& buf, std::size_t len);
+    bool write(int sock);
 
     /**
-     * @brief Receives length of an incoming text message.
+     * @brief Writes until the queue is empty, blocks until the socket is
+     *     writable or @b cancel is set.
+     *
+     * @return True if the queue is empty.
     **/
-    std::optional<std::size_t> recv_maybe_header();
+    bool drain(int sock, const WakeupFlag& cancel);
+
+    SendQueue(SendQueue&&) = delete;
+    SendQueue(const SendQueue&) = delete;
+    SendQueue& operator=(SendQueue&&) = delete;
+    SendQueue& operator=(const SendQueue&) = delete;
+};
+
+
+/**
+ * @brief Persistent per-connection ring buffer of received raw bytes.
+ *     Buffer reads as much as the kernel has and decodes complete packets
+ *     one by one without further system calls.
+ *
+ * @note Capacity is a power of two and grows only if a single packet does
+ *     not fit into the buffer. Packets larger than the limit (configured
+ *     globally via @b set_max_packet) are rejected before any allocation,
+ *     the buffer is unusable afterwards.
+**/
+class RecvBuffer final
+{
+private:
+    static constexpr std::size_t DEFAULT_CAPACITY = 4096;
+    static constexpr std::size_t DEFAULT_MAX_PACKET = 16 << 20;
+    static inline std::atomic<std::size_t> max_packet_ = DEFAULT_MAX_PACKET;
+
+    std::unique_ptr<uint8_t[]> data_;
+    std::size_t capacity_;
+    std::size_t head_;
+    std::size_t tail_;
+    std::size_t oversized_;
+
+    /**
+     * @brief Copies @b len bytes starting at (unmasked) position @b pos.
+    **/
+    void copy_out(std::size_t pos, uint8_t* dst, std::size_t len) const;
+
+    /**
+     * @brief Reallocates the buffer so that at least @b len bytes fit.
+    **/
+    void reserve(std::size_t len);
+
+public:
+    RecvBuffer();
+
+    /**
+     * @brief Sets the largest accepted packet (body) of all buffers.
+    **/
+    static void set_max_packet(std::size_t max_packet);
+
+    /**
+     * @brief Number of buffered bytes.
+    **/
+    std::size_t size() const;
+
+    /**
+     * @brief Length of the rejected packet, 0 if nothing was rejected.
+    **/
+    std::size_t oversized() const;
 
     /**
-     * @brief Receives body part of a packet.
+     * @brief Appends bytes received elsewhere (e.g. by io_uring).
     **/
-    std::optional<Message> recv_maybe_body(std::size_t len);
+    void append(const uint8_t* data, std::size_t len);
+
+    /**
+     * @brief Removes and returns all buffered bytes (e.g. upon hand over
+     *     of the connection).
+    **/
+    std::string take();
+
+    /**
+     * @brief Reads from the socket into free space by one scatter read.
+     *
+     * @return Number of received bytes, 0 upon closed connection, -1 upon
+     *     error with @b errno set.
+    **/
+    ssize_t fill(int sock);
+
+    /**
+     * @brief Decodes the first complete packet, body is built by one copy.
+     *     Nothing is decoded once an oversized packet is announced.
+    **/
+    std::optional<Message> maybe_decode();
+
+    RecvBuffer(RecvBuffer&&) = delete;
+    RecvBuffer(const RecvBuffer&) = delete;
+    RecvBuffer& operator=(RecvBuffer&&) = delete;
+    RecvBuffer& operator=(const RecvBuffer&) = delete;
+};
+
+
+class RecvConnect final
+{
+private:
+    int sock_;
+    RecvBuffer& buffer_;
+    const WakeupFlag& done_;
 
 public:
-    RecvConnect(int sock, const std::atomic_bool& done);
+    RecvConnect(int sock, RecvBuffer& buffer, const WakeupFlag& done);
 
     /**
-     * @brief Main loop of the RecvConnect receives header and message itself,
-     *     stores the message to in-message storage.
+     * @brief Returns the next buffered packet, reads the socket only if no
+     *     complete packet is buffered. Blocks until the socket is readable
+     *     or @b done_ is set, fails upon oversized packet.
+     *
+     * @note Socket shall be configured as non-blocking.
     **/
     std::optional<Message> recv_maybe_message();
 };
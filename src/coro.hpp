@@ -0,0 +1,171 @@
+#ifndef CORO_HPP_
+#define CORO_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file contains a minimal coroutine type used by sessions
+ * driven by CoroLoop.
+**/
+#include <coroutine>
+#include <utility>
+
+
+/**
+ * @brief Lazily started coroutine without result. Awaiting a Task starts
+ *     it and resumes the awaiting coroutine once it completes (symmetric
+ *     transfer), top-level Tasks are started by @b start and owned by
+ *     the event loop.
+ *
+ * @note Exceptions propagate to whoever resumed the coroutine.
+**/
+class Task final
+{
+public:
+    struct promise_type;
+
+private:
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept;
+        std::coroutine_handle<> await_suspend(Handle handle) noexcept;
+        void await_resume() const noexcept;
+    };
+
+    Handle handle_;
+
+    Task(Handle handle);
+
+public:
+    struct promise_type
+    {
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object();
+        std::suspend_always initial_suspend() const noexcept;
+        FinalAwaiter final_suspend() const noexcept;
+        void return_void() const noexcept;
+        void unhandled_exception() const;
+    };
+
+    Task();
+
+    /**
+     * @brief Runs top-level Task until its first suspension.
+    **/
+    void start();
+
+    /**
+     * @brief Task has completed, suspended at its final point.
+    **/
+    bool done() const;
+
+    bool await_ready() const noexcept;
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept;
+    void await_resume() const noexcept;
+
+    Task(Task&& other) noexcept;
+    Task& operator=(Task&& other) noexcept;
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task();
+};
+
+inline Task::Task(Handle handle)
+    : handle_(handle)
+{
+}
+
+inline Task::Task()
+    : handle_()
+{
+}
+
+inline auto Task::FinalAwaiter::await_ready() const noexcept -> bool
+{
+    return false;
+}
+
+inline auto Task::FinalAwaiter::await_suspend(Handle handle) noexcept -> std::coroutine_handle<>
+{
+    auto continuation = handle.promise().continuation;
+    return (continuation) ? continuation : std::noop_coroutine();
+}
+
+inline auto Task::FinalAwaiter::await_resume() const noexcept -> void
+{
+}
+
+inline auto Task::promise_type::get_return_object() -> Task
+{
+    return Task(Handle::from_promise(*this));
+}
+
+inline auto Task::promise_type::initial_suspend() const noexcept -> std::suspend_always
+{
+    return {};
+}
+
+inline auto Task::promise_type::final_suspend() const noexcept -> FinalAwaiter
+{
+    return {};
+}
+
+inline auto Task::promise_type::return_void() const noexcept -> void
+{
+}
+
+inline auto Task::promise_type::unhandled_exception() const -> void
+{
+    throw;
+}
+
+inline auto Task::start() -> void
+{
+    handle_.resume();
+}
+
+inline auto Task::done() const -> bool
+{
+    return !handle_ || handle_.done();
+}
+
+inline auto Task::await_ready() const noexcept -> bool
+{
+    return false;
+}
+
+inline auto Task::await_suspend(std::coroutine_handle<> awaiting) noexcept -> std::coroutine_handle<>
+{
+    handle_.promise().continuation = awaiting;
+    return handle_;
+}
+
+inline auto Task::await_resume() const noexcept -> void
+{
+}
+
+inline Task::Task(Task&& other) noexcept
+    : handle_(std::exchange(other.handle_, {}))
+{
+}
+
+inline auto Task::operator=(Task&& other) noexcept -> Task&
+{
+    if (this != &other) {
+        if (handle_) { handle_.destroy(); }
+        handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+}
+
+inline Task::~Task()
+{
+    if (handle_) { handle_.destroy(); }
+}
+
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef FLAG_HPP_
+#define FLAG_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares thread-safe class WakeupFlag.
+**/
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+/**
+ * @brief Thread-safe boolean flag mimics std::atomic_bool. Additionally,
+ *     the flag provides a descriptor readable while the flag is set, so
+ *     that threads blocked in @b poll could be woken up upon cancellation.
+ *
+ * @note Descriptor is created lazily upon the first request, flags never
+ *     waited for do not allocate any system resources.
+**/
+class WakeupFlag final
+{
+private:
+    std::atomic_bool value_;
+    mutable std::mutex mutex_;
+    mutable int fd_;
+
+public:
+    WakeupFlag(bool value = false);
+
+    /**
+     * @brief Thread-safe load of the current value.
+    **/
+    bool load() const;
+
+    /**
+     * @brief Thread-safe store, setting the flag wakes up all waiters.
+    **/
+    void store(bool value);
+
+    /**
+     * @brief Thread-safe descriptor readable while the flag is set.
+     *
+     * @return -1 if descriptor cannot be created.
+    **/
+    int get_fd() const;
+
+    WakeupFlag(WakeupFlag&&) = delete;
+    WakeupFlag(const WakeupFlag&) = delete;
+    WakeupFlag& operator=(WakeupFlag&&) = delete;
+    WakeupFlag& operator=(const WakeupFlag&) = delete;
+    ~WakeupFlag();
+};
+
+inline WakeupFlag::WakeupFlag(bool value)
+    : value_(value), mutex_(), fd_(-1)
+{
+}
+
+inline auto WakeupFlag::load() const -> bool
+{
+    return value_.load();
+}
+
+inline auto WakeupFlag::store(bool value) -> void
+{
+    // nothing changes, avoid locking on hot paths
+    if (value_.load() == value) { return; }
+
+    std::lock_guard lock(mutex_);
+
+    if (value_.exchange(value) != value && fd_ != -1) {
+        uint64_t cnt = 1;
+        [[maybe_unused]] auto res = (value)
+            ? write(fd_, &cnt, sizeof(cnt))
+            : read(fd_, &cnt, sizeof(cnt));
+    }
+}
+
+inline auto WakeupFlag::get_fd() const -> int
+{
+    std::lock_guard lock(mutex_);
+
+    if (fd_ == -1) {
+        fd_ = eventfd(value_.load() ? 1 : 0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+
+    return fd_;
+}
+
+inline WakeupFlag::~WakeupFlag()
+{
+    if (fd_ != -1) { close(fd_); }
+}
+
+
+#endif
@@ -0,0 +1,153 @@
+#include <cstring>
+#include "history.hpp"
+
+
+constexpr std::size_t HISTORY_SEGMENT_SIZE = 64 << 20; // bytes of one log segment
+
+
+History::History()
+    : rings_(), index_(), log_(), capacity_(0), mutex_(), live_(), read_mutex_()
+{
+}
+
+auto History::encode(const UserPair& pair, const Message& msg) -> std::string
+{
+    std::string result;
+    result.reserve(2 * sizeof(uint32_t) + pair.first.size() + pair.second.size() + msg.size());
+
+    for (auto&& user : { &pair.first, &pair.second }) {
+        uint32_t len = user->size();
+        result.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        result.append(*user);
+    }
+    result.append(msg);
+
+    return result;
+}
+
+auto History::decode(std::string_view payload, UserPair* pair, std::string_view* msg) -> bool
+{
+    for (auto&& user : { &pair->first, &pair->second }) {
+        uint32_t len;
+        if (payload.size() < sizeof(len)) { return false; }
+
+        std::memcpy(&len, payload.data(), sizeof(len));
+        payload.remove_prefix(sizeof(len));
+        if (payload.size() < len) { return false; }
+
+        user->assign(payload.substr(0, len));
+        payload.remove_prefix(len);
+    }
+
+    *msg = payload;
+    return true;
+}
+
+auto History::remember(Index& index, SegmentLog::Location loc) -> void
+{
+    index.locations.push_back(loc);
+    add_live(loc.segment, 1);
+
+    if (index.locations.size() > capacity_) {
+        add_live(index.locations.front().segment, -1);
+        index.locations.pop_front();
+    }
+}
+
+auto History::add_live(uint32_t segment, std::ptrdiff_t cnt) -> void
+{
+    auto&& live = live_[segment];
+    live += cnt;
+    if (live == 0) { live_.erase(segment); }
+}
+
+auto History::compact() -> void
+{
+    std::lock_guard lock(mutex_);
+    auto [first, last] = log_->get_segments();
+
+    auto keep = (live_.empty()) ? (last) : (std::min(live_.begin()->first, last));
+    if (keep <= first) { return; }
+
+    // no message is being copied out of removed segments
+    std::unique_lock read_lock(read_mutex_);
+    log_->truncate_before(keep);
+}
+
+auto History::open(const std::string& dir, std::size_t capacity) -> std::size_t
+{
+    capacity_ = std::max<std::size_t>(capacity, 1);
+    log_ = std::make_unique<SegmentLog>(dir, "history", HISTORY_SEGMENT_SIZE);
+
+    // records are visited in the order of appending
+    UserPair pair;
+    std::string_view msg;
+
+    auto cnt = log_->recover([&](SegmentLog::Location loc, std::string_view payload) {
+        if (!decode(payload, &pair, &msg)) { return; }
+
+        std::lock_guard lock(mutex_);
+        remember(index_.observe(pair), loc);
+    });
+
+    compact();
+    return cnt;
+}
+
+auto History::push_back(const UserPair& pair, const std::vector<MessageRef>& msgs) -> void
+{
+    if (log_ == nullptr) {
+        auto&& ring = rings_.observe(pair);
+        for (auto&& msg : msgs) { ring.push_back(msg); }
+        return;
+    }
+
+    auto&& index = index_.observe(pair);
+    bool rolled = false;
+
+    {
+        // the order of records within a conversation matches the index
+        std::lock_guard lock(index.mutex);
+
+        for (auto&& msg : msgs) {
+            // live count is updated with the append, compaction never misses it
+            std::lock_guard live_lock(mutex_);
+            auto loc = log_->append(encode(pair, *msg));
+            remember(index, loc);
+            rolled = rolled || loc.offset == 0;
+        }
+    }
+
+    if (rolled) { compact(); }
+}
+
+auto History::get_last_n(const UserPair& pair, std::size_t n) -> std::vector<MessageRef>
+{
+    if (log_ == nullptr) { return rings_.observe(pair).get_last_n(n); }
+
+    std::vector<SegmentLog::Location> locations;
+
+    {
+        auto&& index = index_.observe(pair);
+        std::lock_guard lock(index.mutex);
+
+        n = std::min(n, index.locations.size());
+        locations.assign(index.locations.end() - n, index.locations.end());
+    }
+
+    // messages are copied out of mapped segments
+    std::vector<MessageRef> result;
+    result.reserve(locations.size());
+
+    UserPair key;
+    std::string_view msg;
+    std::shared_lock read_lock(read_mutex_);
+
+    for (auto&& loc : locations) {
+        if (decode(log_->read(loc), &key, &msg)) {
+            result.push_back(std::make_shared<const Message>(msg));
+        }
+    }
+
+    return result;
+}
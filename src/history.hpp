@@ -0,0 +1,103 @@
+#ifndef HISTORY_HPP_
+#define HISTORY_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares thread-safe conversation History.
+**/
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+#include "segment_log.hpp"
+#include "storage.hpp"
+
+
+/**
+ * @brief Thread-safe history of delivered messages keyed by an ordered
+ *     pair of users. History is either kept in memory (rings of shared
+ *     messages), or persisted in an append-only SegmentLog.
+ *
+ * @note Persistent History keeps only record locations in memory, HIST
+ *     reads messages directly from memory-mapped segments. The index is
+ *     rebuilt by scanning segments upon @b open. Leading segments without
+ *     records in any index are removed whenever the log starts a new one.
+**/
+class History final
+{
+private:
+    struct Index
+    {
+        std::mutex mutex;
+        std::deque<SegmentLog::Location> locations;
+    };
+
+    using IndexMap = ShardedMapStorage<UserPair, Index, GLOBAL_MAP_SHARDS>;
+
+    HistoryMap rings_;
+    IndexMap index_;
+    std::unique_ptr<SegmentLog> log_;
+    std::size_t capacity_;
+
+    std::mutex mutex_;
+    std::map<uint32_t, std::size_t> live_;
+    std::shared_mutex read_mutex_;
+
+    /**
+     * @brief Record payload is [len a][a][len b][b][message], lengths are
+     *     32-bit integers in host byte order.
+    **/
+    static std::string encode(const UserPair& pair, const Message& msg);
+    static bool decode(std::string_view payload, UserPair* pair, std::string_view* msg);
+
+    /**
+     * @brief Remembers location of the latest record, the oldest one is
+     *     forgotten once retention is reached.
+     *
+     * @note Shall be called with locked @b index.mutex and @b mutex_ .
+    **/
+    void remember(Index& index, SegmentLog::Location loc);
+
+    void add_live(uint32_t segment, std::ptrdiff_t cnt);
+
+    /**
+     * @brief Removes leading segments without indexed records.
+    **/
+    void compact();
+
+public:
+    History();
+
+    /**
+     * @brief Switches to persistent mode, log segments are kept in @b dir.
+     *     At most @b capacity latest messages per conversation are served.
+     *     Throws @b std::runtime_error if the log cannot be used.
+     *
+     * @return Number of recovered messages.
+    **/
+    std::size_t open(const std::string& dir, std::size_t capacity);
+
+    /**
+     * @brief Thread-safe append of delivered messages, the order is kept.
+    **/
+    void push_back(const UserPair& pair, const std::vector<MessageRef>& msgs);
+
+    /**
+     * @brief Thread-safe snapshot of up to @b n latest messages, the oldest
+     *     first.
+    **/
+    std::vector<MessageRef> get_last_n(const UserPair& pair, std::size_t n);
+
+    History(History&&) = delete;
+    History(const History&) = delete;
+    History& operator=(History&&) = delete;
+    History& operator=(const History&) = delete;
+};
+
+
+#endif
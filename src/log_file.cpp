@@ -0,0 +1,133 @@
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "log_file.hpp"
+
+
+LogFile::Buffer::Buffer(const std::string& path, std::size_t max_size, std::chrono::seconds max_age, std::chrono::milliseconds sync_period)
+    : std::streambuf(), path_(path), max_size_(max_size), max_age_(max_age), sync_period_(sync_period), pending_(), size_(0), opened_(), mutex_(), fd_(-1), dirty_(false), stop_(false), cond_(), syncer_()
+{
+    open_file();
+
+    if (sync_period_.count() > 0) {
+        syncer_ = std::thread([this]() { sync_loop(); });
+    }
+}
+
+auto LogFile::Buffer::open_file() -> void
+{
+    fd_ = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ == -1) {
+        throw std::runtime_error("Log file " + path_ + " cannot be opened.");
+    }
+
+    struct stat st;
+    size_ = (fstat(fd_, &st) == 0) ? st.st_size : 0;
+    opened_ = std::chrono::steady_clock::now();
+}
+
+auto LogFile::Buffer::rotate() -> void
+{
+    if (dirty_) { fdatasync(fd_); dirty_ = false; }
+    close(fd_);
+    fd_ = -1;
+
+    // path.N-1 -> path.N, ..., path -> path.1, the oldest one is overwritten
+    for (int i = KEEP_FILES - 1; i >= 0; --i) {
+        auto from = (i == 0) ? (path_) : (path_ + '.' + std::to_string(i));
+        std::rename(from.c_str(), (path_ + '.' + std::to_string(i + 1)).c_str());
+    }
+
+    open_file();
+}
+
+auto LogFile::Buffer::xsputn(const char* s, std::streamsize n) -> std::streamsize
+{
+    pending_.append(s, n);
+    return n;
+}
+
+auto LogFile::Buffer::overflow(int_type c) -> int_type
+{
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        pending_.push_back(traits_type::to_char_type(c));
+    }
+    return traits_type::not_eof(c);
+}
+
+auto LogFile::Buffer::sync() -> int
+{
+    if (pending_.empty()) { return 0; }
+
+    std::lock_guard lock(mutex_);
+
+    auto now = std::chrono::steady_clock::now();
+    auto expired = (max_size_ > 0 && size_ >= max_size_) || (max_age_.count() > 0 && now - opened_ >= max_age_);
+
+    // file is reopened after failed rotation
+    try {
+        if (fd_ == -1) { open_file(); }
+        else if (expired) { rotate(); }
+    } catch (...) { }
+
+    // failed batch is dropped, logging shall go on after transient errors
+    std::size_t pos = 0;
+    while (fd_ != -1 && pos < pending_.size()) {
+        auto cnt = ::write(fd_, pending_.data() + pos, pending_.size() - pos);
+        if (cnt > 0) { pos += cnt; continue; }
+        if (cnt == -1 && errno == EINTR) { continue; }
+        break;
+    }
+
+    size_ += pos;
+    dirty_ = dirty_ || (pos > 0);
+    pending_.clear();
+
+    return 0;
+}
+
+auto LogFile::Buffer::sync_loop() -> void
+{
+    std::unique_lock lock(mutex_);
+
+    while (!stop_) {
+        cond_.wait_for(lock, sync_period_, [&]() { return stop_; });
+
+        if (!dirty_ || fd_ == -1) { continue; }
+
+        // the logger keeps writing while the duplicate is synced, it also
+        // stays valid if the file is rotated meanwhile
+        auto fd = dup(fd_);
+        dirty_ = false;
+        if (fd == -1) { continue; }
+
+        lock.unlock();
+        fdatasync(fd);
+        close(fd);
+        lock.lock();
+    }
+}
+
+LogFile::Buffer::~Buffer()
+{
+    sync();
+
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+
+    if (syncer_.joinable()) { syncer_.join(); }
+    if (fd_ != -1) { close(fd_); }
+}
+
+
+LogFile::LogFile(const std::string& path, std::size_t max_size, std::chrono::seconds max_age, std::chrono::milliseconds sync_period)
+    : std::ostream(nullptr), buffer_(path, max_size, max_age, sync_period)
+{
+    rdbuf(&buffer_);
+}
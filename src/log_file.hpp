@@ -0,0 +1,99 @@
+#ifndef LOG_FILE_HPP_
+#define LOG_FILE_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares rotating file output stream LogFile.
+**/
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+
+/**
+ * @brief Output stream appending to a file, the file is rotated once it
+ *     exceeds the size or the age limit (@b path is renamed to @b path.1 ,
+ *     @b path.1 to @b path.2 , etc.). Text is accumulated in memory and
+ *     written upon @b flush by one @b write (O_APPEND).
+ *
+ * @note Intended as Logger stream, flushed once per drain. Optional
+ *     background thread calls @b fdatasync periodically.
+**/
+class LogFile final : public std::ostream
+{
+private:
+    class Buffer final : public std::streambuf
+    {
+    private:
+        static constexpr int KEEP_FILES = 5;
+
+        std::string path_;
+        std::size_t max_size_;
+        std::chrono::seconds max_age_;
+        std::chrono::milliseconds sync_period_;
+
+        std::string pending_;
+        std::size_t size_;
+        std::chrono::steady_clock::time_point opened_;
+
+        std::mutex mutex_;
+        int fd_;
+        bool dirty_;
+        bool stop_;
+        std::condition_variable cond_;
+        std::thread syncer_;
+
+        /**
+         * @brief Opens (creates) the file for appending.
+         *     Throws @b std::runtime_error upon failure.
+        **/
+        void open_file();
+
+        /**
+         * @brief Renames the current file and opens a new one.
+         *
+         * @note Shall be called with locked @b mutex_.
+        **/
+        void rotate();
+
+        void sync_loop();
+
+    protected:
+        std::streamsize xsputn(const char* s, std::streamsize n) override;
+        int_type overflow(int_type c) override;
+        int sync() override;
+
+    public:
+        Buffer(const std::string& path, std::size_t max_size, std::chrono::seconds max_age, std::chrono::milliseconds sync_period);
+        ~Buffer();
+    };
+
+    Buffer buffer_;
+
+public:
+
+    /**
+     * @brief Throws @b std::runtime_error if the file cannot be opened.
+     *
+     * @param max_size rotate after the file reaches this many bytes.
+     * @param max_age rotate after the file has been open this long.
+     *     Zero limits are disabled.
+     * @param sync_period @b fdatasync period, zero disables syncing.
+    **/
+    LogFile(const std::string& path, std::size_t max_size, std::chrono::seconds max_age, std::chrono::milliseconds sync_period);
+
+    LogFile(LogFile&&) = delete;
+    LogFile(const LogFile&) = delete;
+    LogFile& operator=(LogFile&&) = delete;
+    LogFile& operator=(const LogFile&) = delete;
+};
+
+
+#endif
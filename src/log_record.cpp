@@ -0,0 +1,92 @@
+#include <mutex>
+#include <string_view>
+#include <arpa/inet.h>
+#include "log_record.hpp"
+
+
+/**
+ * @brief Templates indexed by LogFormat.
+**/
+constexpr std::string_view LOG_FORMATS[] = {
+    "",
+    "New connection from peer {p}.",
+    "Closing connection with peer {p}.",
+    "Error {d} upon accepting new socket.",
+    "Socket {d} cannot be watched by Reactor.",
+    "Chat {n} -> {n} started.",
+    "Chat {n} -> {n} ended.",
+    "Bad Command received on socket {d}, internal Session error.",
+    "Bad ClientMode on socket {d}, internal Session error.",
+    "Socket {d} done in ClientMode {d}.",
+    "Packet of {d} bytes rejected on socket {d}, limit exceeded."
+};
+
+
+auto LogNames::intern(const std::string& name) -> LogName
+{
+    {
+        std::shared_lock lock(mutex_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) { return it->second; }
+    }
+
+    std::lock_guard lock(mutex_);
+    auto [it, inserted] = ids_.try_emplace(name, static_cast<LogName>(names_.size()));
+    if (inserted) { names_.push_back(name); }
+
+    return it->second;
+}
+
+auto LogNames::get(LogName id) -> std::string
+{
+    std::shared_lock lock(mutex_);
+    return (id < names_.size()) ? (names_[id]) : (std::string());
+}
+
+
+auto make_log_peer(const sockaddr_in& addr) -> uint64_t
+{
+    return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | ntohs(addr.sin_port);
+}
+
+
+auto operator<<(std::ostream& os, const LogRecord& record) -> std::ostream&
+{
+    auto idx = static_cast<std::size_t>(record.format);
+    if (idx >= std::size(LOG_FORMATS)) { return os << "Unknown log record " << idx << '.'; }
+
+    auto fmt = LOG_FORMATS[idx];
+    std::size_t arg = 0;
+
+    for (std::size_t i = 0; i < fmt.size(); ++i) {
+        if (fmt[i] != '{' || i + 2 >= fmt.size() || fmt[i + 2] != '}' || arg >= LogRecord::MAX_ARGS) {
+            os << fmt[i];
+            continue;
+        }
+
+        auto value = record.args[arg++];
+
+        switch (fmt[i + 1])
+        {
+        case 'n':
+            os << LogNames::get(static_cast<LogName>(value));
+            break;
+        case 'p':
+        {
+            in_addr addr{ .s_addr = static_cast<in_addr_t>(value >> 16) };
+            char buf[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &addr, buf, INET_ADDRSTRLEN);
+            os << buf << " port " << (value & 0xFFFF);
+        }
+        break;
+        case 'd':
+        default:
+            os << static_cast<int64_t>(value);
+            break;
+        }
+
+        i += 2;
+    }
+
+    return os;
+}
@@ -0,0 +1,118 @@
+#ifndef LOG_RECORD_HPP_
+#define LOG_RECORD_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares fixed-size log records with deferred
+ * formatting used by the server.
+**/
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <netinet/in.h>
+#include "logger.hpp"
+
+
+/**
+ * @brief Format id of a log record, see @b LOG_FORMATS for templates.
+**/
+enum class LogFormat : uint16_t
+{
+    NONE,
+    NEW_CONNECTION,
+    CLOSE_CONNECTION,
+    ACCEPT_ERROR,
+    NOT_WATCHED,
+    CHAT_STARTED,
+    CHAT_ENDED,
+    BAD_COMMAND,
+    BAD_MODE,
+    SESSION_DONE,
+    PACKET_TOO_LARGE
+};
+
+
+/**
+ * @brief Id of an interned name.
+**/
+using LogName = uint32_t;
+
+
+/**
+ * @brief Thread-safe global table of interned names. Names are interned
+ *     once (e.g. upon log in), so that log records carry integers only.
+ *
+ * @note Names are never removed.
+**/
+class LogNames final
+{
+private:
+    static inline std::shared_mutex mutex_;
+    static inline std::unordered_map<std::string, LogName> ids_;
+    static inline std::deque<std::string> names_;
+
+public:
+    static LogName intern(const std::string& name);
+
+    /**
+     * @brief Name interned under @b id, empty if unknown.
+    **/
+    static std::string get(LogName id);
+};
+
+
+/**
+ * @brief Fixed-size log record, format id and raw arguments only. Record
+ *     is formatted upon output (on the logger thread).
+ *
+ * @note Template placeholders define types of arguments: @b {d} integer,
+ *     @b {n} interned name, @b {p} peer (IPv4 address and port).
+**/
+struct LogRecord
+{
+    static constexpr std::size_t MAX_ARGS = 3;
+
+    LogFormat format;
+    std::array<uint64_t, MAX_ARGS> args;
+
+    LogRecord();
+
+    template <typename... Args>
+    LogRecord(LogFormat format, Args... args);
+};
+
+inline LogRecord::LogRecord()
+    : format(LogFormat::NONE), args()
+{
+}
+
+template <typename... Args>
+inline LogRecord::LogRecord(LogFormat format, Args... args)
+    : format(format), args{ static_cast<uint64_t>(args)... }
+{
+    static_assert(sizeof...(Args) <= MAX_ARGS, "Too many log record arguments.");
+}
+
+
+/**
+ * @brief Packs peer address into one record argument.
+**/
+uint64_t make_log_peer(const sockaddr_in& addr);
+
+
+/**
+ * @brief Renders the record according to its format template.
+**/
+std::ostream& operator<<(std::ostream& os, const LogRecord& record);
+
+
+using ServerLogger = Logger<LogRecord>;
+
+
+#endif
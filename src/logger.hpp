@@ -7,32 +7,79 @@
  *
  * This header file declares thread-safe class Logger.
 **/
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <mutex>
 #include <ostream>
+#include <sstream>
 #include <string>
-#include <queue>
 #include <thread>
+#include <vector>
+
+
+/**
+ * @brief Behavior of Logger upon full buffer.
+**/
+enum class LoggerOverflow
+{
+    DROP,  // message is discarded and counted, the count is reported later
+    BLOCK  // producer waits until the consumer makes space
+};
 
 
 /**
  * @brief Thread-safe logger parametrized by a general output stream.
- *     Messages are dumped in batches. Logger shall own passed stream
+ *     Producers push messages into a lock-free bounded ring buffer
+ *     (Vyukov's MPMC queue), the consumer drains the whole buffer and
+ *     dumps it by one buffered write. Logger shall own passed stream
  *     exclusively!
+ *
+ * @note The consumer sleeps on a condition variable while the buffer is
+ *     empty, producers lock the mutex only to wake it up.
 **/
 template <typename T>
 class Logger final
 {
 private:
+    struct Cell
+    {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
     static constexpr int64_t LOGGER_FREQ = 100;
-    static constexpr std::size_t BATCH_SIZE = 10;
+    static constexpr std::size_t DEFAULT_CAPACITY = 1 << 16;
 
-    std::mutex mutex_;
     std::ostream* stream_;
-    std::queue<T> queue_;
+    LoggerOverflow overflow_;
+    std::vector<Cell> ring_;
+    std::size_t mask_;
+
+    alignas(64) std::atomic<std::size_t> enqueue_pos_;
+    alignas(64) std::size_t dequeue_pos_;
+    alignas(64) std::atomic<std::size_t> dropped_;
+    std::atomic_bool sleeping_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+
+    template <typename U>
+    bool try_push(U&& message);
+
+    template <typename U>
+    void push(U&& message);
+
+    bool try_pop(T& message);
+    bool empty() const;
 
 public:
-    Logger(std::ostream* stream);
+
+    /**
+     * @brief Capacity of the buffer is rounded up to a power of two.
+    **/
+    Logger(std::ostream* stream, std::size_t capacity = DEFAULT_CAPACITY, LoggerOverflow overflow = LoggerOverflow::DROP);
 
     /**
      * @brief Thread-safe message logging with move semantics.
@@ -45,10 +92,20 @@ public:
     void log(const T& message);
 
     /**
-     * @brief Thread-safe retrieve input messages from queue in batches and
-     *     dumps it into output stream.
+     * @brief Replaces output stream, shall be called before @b loop.
+    **/
+    void set_stream(std::ostream* stream);
+
+    /**
+     * @brief Number of messages dropped so far due to full buffer.
+    **/
+    std::size_t dropped() const;
+
+    /**
+     * @brief Waits for messages and dumps all of them into output stream,
+     *     runs until @b done is set and the buffer is empty.
      *
-     * @param batch_size configures a maximum size of the batch.
+     * @note Shall be run by exactly one thread.
     **/
     void loop(const std::atomic_bool& done);
 
@@ -59,53 +116,150 @@ public:
 };
 
 template <typename T>
-inline Logger<T>::Logger(std::ostream* stream)
-    : mutex_(), stream_(stream), queue_()
+inline Logger<T>::Logger(std::ostream* stream, std::size_t capacity, LoggerOverflow overflow)
+    : stream_(stream), overflow_(overflow), ring_(), mask_(0), enqueue_pos_(0), dequeue_pos_(0), dropped_(0), sleeping_(false), mutex_(), cond_()
 {
+    std::size_t size = 2;
+    while (size < capacity) { size <<= 1; }
+
+    ring_ = std::vector<Cell>(size);
+    for (std::size_t i = 0; i < size; ++i) { ring_[i].seq.store(i, std::memory_order_relaxed); }
+    mask_ = size - 1;
+}
+
+template <typename T>
+template <typename U>
+inline auto Logger<T>::try_push(U&& message) -> bool
+{
+    auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+
+    // claim a cell, sequence number tells whether it is free in this round
+    for (;;) {
+        cell = &ring_[pos & mask_];
+        auto seq = cell->seq.load(std::memory_order_acquire);
+        auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+        if (diff == 0 && enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+        if (diff < 0) { return false; }
+        if (diff > 0) { pos = enqueue_pos_.load(std::memory_order_relaxed); }
+    }
+
+    cell->value = std::forward<U>(message);
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    return true;
+}
+
+template <typename T>
+template <typename U>
+inline auto Logger<T>::push(U&& message) -> void
+{
+    while (!try_push(std::forward<U>(message))) {
+        if (overflow_ == LoggerOverflow::DROP) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        // full buffer, let the consumer run
+        cond_.notify_one();
+        std::this_thread::yield();
+    }
+
+    // pairs with the fence of loop (store-load), either the producer
+    // observes the sleeping consumer or the consumer observes the cell
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // wake up the consumer only if it sleeps
+    if (sleeping_.load()) {
+        std::lock_guard lock(mutex_);
+        cond_.notify_one();
+    }
+}
+
+template <typename T>
+inline auto Logger<T>::try_pop(T& message) -> bool
+{
+    auto&& cell = ring_[dequeue_pos_ & mask_];
+
+    if (cell.seq.load(std::memory_order_acquire) != dequeue_pos_ + 1) { return false; }
+
+    message = std::move(cell.value);
+    cell.value = T();
+    cell.seq.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+    ++dequeue_pos_;
+
+    return true;
+}
+
+template <typename T>
+inline auto Logger<T>::empty() const -> bool
+{
+    return ring_[dequeue_pos_ & mask_].seq.load(std::memory_order_acquire) != dequeue_pos_ + 1;
 }
 
 template <typename T>
 inline auto Logger<T>::log(T&& message) -> void
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(std::move(message));
+    push(std::move(message));
 }
 
 template <typename T>
 inline auto Logger<T>::log(const T& message) -> void
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    queue_.push(message);
+    push(message);
+}
+
+template <typename T>
+inline auto Logger<T>::set_stream(std::ostream* stream) -> void
+{
+    stream_ = stream;
+}
+
+template <typename T>
+inline auto Logger<T>::dropped() const -> std::size_t
+{
+    return dropped_.load(std::memory_order_relaxed);
 }
 
 template <typename T>
 inline auto Logger<T>::loop(const std::atomic_bool& done) -> void
 {
-    for(;;) {
-        std::vector<T> buffer;
+    std::ostringstream buffer;
+    std::size_t reported = 0;
+    T item;
 
-        // retrieve messages until done and empty
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
+    for (;;) {
+        std::size_t cnt = 0;
 
-            if (done.load() && queue_.empty()) {
-                break;
-            }
+        // drain the whole buffer, at most one round under steady load
+        for (; cnt <= mask_ && try_pop(item); ++cnt) { buffer << item << '\n'; }
 
-            for (std::size_t i = 0; i < BATCH_SIZE && !queue_.empty(); ++i) {
-                buffer.emplace_back(std::move(queue_.front()));
-                queue_.pop();
-            }
+        auto dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reported) {
+            buffer << "Logger dropped " << (dropped - reported) << " messages." << '\n';
+            reported = dropped;
+            ++cnt;
         }
 
-        // dump retrieved messages
-        for (auto&& item : buffer) {
-            if (stream_->good()) {
-                *stream_ << item << std::endl;
-            }
+        // one buffered write per drain
+        if (cnt > 0) {
+            auto str = std::move(buffer).str();
+            if (stream_->good()) { stream_->write(str.data(), str.size()).flush(); }
+            buffer.str(std::string());
+            continue;
         }
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(LOGGER_FREQ));
+        if (done.load()) { break; }
+
+        // sleep until a producer wakes up the consumer, recheck after announcing
+        std::unique_lock lock(mutex_);
+        sleeping_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (empty()) {
+            cond_.wait_for(lock, std::chrono::milliseconds(LOGGER_FREQ));
+        }
+        sleeping_.store(false);
     }
 }
 
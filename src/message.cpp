@@ -1,72 +1,424 @@
 #include <algorithm>
-#include <map>
+#include <array>
 #include "utility.hpp"
 #include "message.hpp"
+#include "session.hpp"
 
 
-bool is_hist_count_valid(const std::string& cnt)
+constexpr unsigned long MAX_HIST_COUNT = 10;
+
+
+struct Keyword
 {
-    const unsigned long MAX_COUNT = 10;
+    std::string_view word;
+    Command command;
+};
 
-    auto d = std::all_of(cnt.begin(), cnt.end(), [](char c){
-        return std::isdigit(c);
-    });
 
-    auto l = std::strtoul(cnt.c_str(), nullptr, 10) <= MAX_COUNT;
+constexpr std::array<Keyword, 7> KEYWORDS {{
+    { "help", Command::HELP },
+    { "pend", Command::PEND },
+    { "quit", Command::QUIT },
+    { "chat", Command::CHAT },
+    { "hist", Command::HIST },
+    { "join", Command::JOIN },
+    { "leave", Command::LEAVE }
+}};
 
-    return d && l;
+
+/**
+ * @brief Perfect hash of keywords (the first and the third char), words
+ *     shorter than three chars are never keywords.
+**/
+constexpr std::size_t keyword_hash(std::string_view word)
+{
+    return (static_cast<unsigned char>(word[0]) ^ static_cast<unsigned char>(word[2])) & 0xF;
 }
 
 
-bool is_chat_command_format(const std::vector<std::string>& words)
+constexpr auto KEYWORD_TABLE = []() {
+    std::array<Keyword, 16> table{};
+    for (auto&& keyword : table) { keyword = { "", Command::BAD }; }
+    for (auto&& keyword : KEYWORDS) { table[keyword_hash(keyword.word)] = keyword; }
+    return table;
+}();
+
+
+static_assert(
+    std::all_of(KEYWORDS.begin(), KEYWORDS.end(), [](const Keyword& k) {
+        return KEYWORD_TABLE[keyword_hash(k.word)].word == k.word;
+    }),
+    "Keyword hash shall be perfect."
+);
+
+
+constexpr Command match_keyword(std::string_view word)
 {
-    return words.size() == 2
-        && words[0] == "chat"
-        && is_user_name_valid(words[1]);
+    if (word.size() < 3) { return Command::BAD; }
+
+    auto&& keyword = KEYWORD_TABLE[keyword_hash(word)];
+    return (keyword.word == word) ? (keyword.command) : (Command::BAD);
 }
 
 
-bool is_hist_command_format(const std::vector<std::string>& words)
+/**
+ * @brief Digits only, value shall not exceed @b MAX_HIST_COUNT .
+**/
+constexpr bool parse_hist_count(std::string_view word, unsigned long& count)
 {
-    return words.size() == 3
-        && words[0] == "hist"
-        && is_hist_count_valid(words[1])
-        && is_user_name_valid(words[2]);
+    count = 0;
+
+    for (auto c : word) {
+        if (c < '0' || c > '9') { return false; }
+
+        count = count * 10 + (c - '0');
+        if (count > MAX_HIST_COUNT) { return false; }
+    }
+
+    return !word.empty();
 }
 
 
-auto parse_command(const std::string& input) -> Command
+auto split_log_in(std::string_view msg, bool& binary, bool& acks) -> std::string_view
+{
+    auto strip = [&](std::string_view tag) {
+        if (!msg.ends_with(tag)) { return false; }
+        msg.remove_suffix(tag.size());
+        return true;
+    };
+
+    // tags could follow in any order
+    for (bool found = true; found; ) {
+        found = false;
+        if (strip(BINARY_PROTOCOL_TAG)) { binary = found = true; }
+        if (strip(ACK_PROTOCOL_TAG)) { acks = found = true; }
+    }
+
+    return msg;
+}
+
+
+auto parse_message_id(std::string_view word, uint64_t& id) -> bool
+{
+    id = 0;
+
+    for (auto c : word) {
+        if (c < '0' || c > '9' || id > (UINT64_MAX - (c - '0')) / 10) { return false; }
+        id = id * 10 + (c - '0');
+    }
+
+    return !word.empty();
+}
+
+
+/**
+ * @brief Chats and histories are either with a user or with a room.
+**/
+bool is_chat_name_valid(std::string_view name)
+{
+    return is_user_name_valid(name) || is_room_name_valid(name);
+}
+
+
+auto decode_text_command(std::string_view input) -> CommandView
 {
-    auto words = split_string(input);
+    std::array<std::string_view, 3> words;
+    auto cnt = split_string(input, words.data(), words.size());
 
-    // help, pending/waiting userX messages, quit
-    if (words.size() == 1) {
-        std::map<std::string, Command> m {
-            { "help", Command::HELP },
-            { "pend", Command::PEND },
-            { "quit", Command::QUIT }
-        };
+    CommandView result{ .command = (cnt > 0) ? match_keyword(words[0]) : Command::BAD };
+    bool succ;
 
-        auto it = m.find(words[0]);
-        if (it != m.end()) { return it->second; }
+    // arguments are validated in the same pass
+    switch (result.command)
+    {
+    case Command::HELP:
+    case Command::PEND:
+    case Command::QUIT:
+        succ = (cnt == 1);
+        break;
+    case Command::CHAT:
+        succ = (cnt == 2 || (cnt == 3 && parse_message_id(words[2], result.last_id))) && is_chat_name_valid(words[1]);
+        result.name = words[1];
+        break;
+    case Command::HIST:
+        succ = (cnt == 3) && parse_hist_count(words[1], result.count) && is_chat_name_valid(words[2]);
+        result.name = words[2];
+        break;
+    case Command::JOIN:
+    case Command::LEAVE:
+        succ = (cnt == 2) && is_room_name_valid(words[1]);
+        result.name = words[1];
+        break;
+    default:
+        succ = false;
+        break;
     }
 
-    if (is_chat_command_format(words)) { return Command::CHAT; }
+    if (!succ) { return CommandView{ }; }
+
+    return result;
+}
 
-    if (is_hist_command_format(words)) { return Command::HIST; }
 
-    return Command::BAD;
+auto parse_command(const std::string& input) -> Command
+{
+    return decode_text_command(input).command;
 }
 
 
 auto parse_chat_command(const std::string& command) -> std::string
 {
-    return split_string(command)[1];
+    return std::string(decode_text_command(command).name);
 }
 
 
 auto parse_hist_command(const std::string& command) -> std::pair<unsigned long, std::string>
 {
-    auto tokens = split_string(command);
-    return { std::strtoul(tokens[1].c_str(), nullptr, 10), std::move(tokens[2]) };
+    auto result = decode_text_command(command);
+    return { result.count, std::string(result.name) };
+}
+
+
+/**
+ * @brief Reads unsigned LEB128 varint, advances @b pos .
+**/
+bool read_varint(std::string_view body, std::size_t& pos, uint64_t& value)
+{
+    value = 0;
+
+    for (unsigned shift = 0; pos < body.size() && shift < 64; shift += 7) {
+        auto byte = static_cast<uint8_t>(body[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) { return true; }
+    }
+
+    return false;
+}
+
+
+void write_varint(std::string& out, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        out.push_back(static_cast<char>(byte | (value != 0 ? 0x80 : 0)));
+    } while (value != 0);
+}
+
+
+auto decode_binary_command(std::string_view body) -> CommandView
+{
+    CommandView result;
+    std::size_t pos = 1;
+
+    // name is a varint length followed by a user or room name
+    auto read_name = [&](auto&& is_valid) {
+        uint64_t len;
+        if (!read_varint(body, pos, len) || len > body.size() - pos) { return false; }
+
+        result.name = body.substr(pos, len);
+        pos += len;
+        return is_valid(result.name);
+    };
+
+    auto succ = !body.empty();
+    auto opcode = (succ) ? (static_cast<uint8_t>(body[0])) : (0);
+
+    // request id precedes arguments
+    if (opcode & TAGGED_OPCODE) {
+        opcode &= ~TAGGED_OPCODE;
+        result.tagged = true;
+        succ = read_varint(body, pos, result.request_id);
+    }
+
+    switch (succ ? static_cast<Opcode>(opcode) : Opcode())
+    {
+    case Opcode::PEND:
+        result.command = Command::PEND;
+        break;
+    case Opcode::QUIT:
+        result.command = Command::QUIT;
+        break;
+    case Opcode::CHAT:
+        result.command = Command::CHAT;
+        succ = read_name(is_chat_name_valid) && (pos == body.size() || read_varint(body, pos, result.last_id));
+        break;
+    case Opcode::HIST:
+    {
+        uint64_t count = 0;
+        result.command = Command::HIST;
+        succ = read_varint(body, pos, count) && count <= MAX_HIST_COUNT && read_name(is_chat_name_valid);
+        result.count = count;
+    }
+    break;
+    case Opcode::JOIN:
+        result.command = Command::JOIN;
+        succ = read_name(is_room_name_valid);
+        break;
+    case Opcode::LEAVE:
+        result.command = Command::LEAVE;
+        succ = read_name(is_room_name_valid);
+        break;
+    default:
+        succ = false;
+        break;
+    }
+
+    // trailing bytes are not allowed
+    if (!succ || pos != body.size()) { return CommandView{ }; }
+
+    return result;
+}
+
+
+auto encode_binary_command(Command command, unsigned long count, std::string_view name, uint64_t last_id) -> std::string
+{
+    std::string result;
+
+    switch (command)
+    {
+    case Command::PEND:
+        result.push_back(static_cast<char>(Opcode::PEND));
+        break;
+    case Command::QUIT:
+        result.push_back(static_cast<char>(Opcode::QUIT));
+        break;
+    case Command::CHAT:
+        result.push_back(static_cast<char>(Opcode::CHAT));
+        write_varint(result, name.size());
+        result.append(name);
+        if (last_id > 0) { write_varint(result, last_id); }
+        break;
+    case Command::HIST:
+        result.push_back(static_cast<char>(Opcode::HIST));
+        write_varint(result, count);
+        write_varint(result, name.size());
+        result.append(name);
+        break;
+    case Command::JOIN:
+    case Command::LEAVE:
+        result.push_back(static_cast<char>((command == Command::JOIN) ? Opcode::JOIN : Opcode::LEAVE));
+        write_varint(result, name.size());
+        result.append(name);
+        break;
+    default:
+        break;
+    }
+
+    return result;
+}
+
+
+auto split_chunks(std::string_view msg, std::size_t chunk_size, std::string_view marker) -> std::vector<std::string>
+{
+    std::vector<std::string> result;
+    auto step = chunk_size - marker.size();
+
+    while (msg.size() > chunk_size) {
+        auto&& chunk = result.emplace_back();
+        chunk.reserve(chunk_size);
+        chunk.append(marker).append(msg.substr(0, step));
+        msg.remove_prefix(step);
+    }
+    result.emplace_back(msg);
+
+    return result;
+}
+
+
+auto encode_room_message(std::string_view sender, std::string_view msg, std::string_view marker) -> std::string
+{
+    std::string result;
+    auto chunk = msg.starts_with(marker);
+
+    if (chunk) { msg.remove_prefix(marker.size()); }
+
+    result.reserve((chunk ? marker.size() : 0) + sender.size() + 2 + msg.size());
+    if (chunk) { result.append(marker); }
+    result.append(sender).append(": ").append(msg);
+
+    return result;
+}
+
+
+auto decode_room_message(std::string_view body, std::string_view& sender, std::string_view& text) -> bool
+{
+    auto pos = body.find(": ");
+    if (pos == std::string_view::npos) { return false; }
+
+    sender = body.substr(0, pos);
+    text = body.substr(pos + 2);
+    return true;
+}
+
+
+auto encode_chat_frame(uint64_t id, std::string_view body) -> std::string
+{
+    auto result = std::to_string(id);
+    result.push_back(':');
+    result.append(body);
+    return result;
+}
+
+
+auto decode_chat_frame(std::string_view frame, uint64_t& id, std::string_view& body) -> bool
+{
+    auto pos = frame.find(':');
+    if (pos == std::string_view::npos || !parse_message_id(frame.substr(0, pos), id)) { return false; }
+
+    body = frame.substr(pos + 1);
+    return true;
+}
+
+
+auto tag_binary_command(uint64_t request_id, const std::string& command) -> std::string
+{
+    std::string result;
+    if (command.empty()) { return result; }
+
+    result.push_back(static_cast<char>(static_cast<uint8_t>(command[0]) | TAGGED_OPCODE));
+    write_varint(result, request_id);
+    result.append(command, 1);
+
+    return result;
+}
+
+
+auto encode_tagged_response(uint64_t request_id, std::span<const std::shared_ptr<const std::string>> items) -> std::string
+{
+    std::size_t size = 20;
+    for (auto&& item : items) { size += item->size() + 10; }
+
+    std::string result;
+    result.reserve(size);
+
+    write_varint(result, request_id);
+    write_varint(result, items.size());
+
+    for (auto&& item : items) {
+        write_varint(result, item->size());
+        result.append(*item);
+    }
+
+    return result;
+}
+
+
+auto decode_tagged_response(std::string_view body, uint64_t& request_id, std::vector<std::string_view>& items) -> bool
+{
+    std::size_t pos = 0;
+    uint64_t cnt;
+
+    items.clear();
+    if (!read_varint(body, pos, request_id) || !read_varint(body, pos, cnt)) { return false; }
+
+    for (uint64_t i = 0; i < cnt; ++i) {
+        uint64_t len;
+        if (!read_varint(body, pos, len) || len > body.size() - pos) { return false; }
+
+        items.push_back(body.substr(pos, len));
+        pos += len;
+    }
+
+    return pos == body.size();
 }
@@ -7,7 +7,12 @@
  *
  * This header file declares Message structures and operations on messages.
 **/
+#include <cstdint>
+#include <memory>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 
 
 enum class Command
@@ -17,10 +22,139 @@ enum class Command
     QUIT,
     CHAT,
     HIST,
+    JOIN,
+    LEAVE,
     BAD
 };
 
 
+/**
+ * @brief Opcodes of binary commands. Arguments follow the opcode, counts
+ *     are unsigned LEB128 varints and names are prefixed by varint length.
+ *
+ * @note @b PEND and @b QUIT have no arguments, @b CHAT is followed by
+ *     a name and an optional last received id, @b HIST by a count and
+ *     a name, @b JOIN and @b LEAVE by a room name. Opcode with @b TAGGED_OPCODE bit is followed by a varint
+ *     request id, see @b encode_tagged_response .
+**/
+enum class Opcode : uint8_t
+{
+    PEND = 1,
+    QUIT = 2,
+    CHAT = 3,
+    HIST = 4,
+    JOIN = 5,
+    LEAVE = 6
+};
+
+
+constexpr uint8_t TAGGED_OPCODE = 0x80;
+
+
+/**
+ * @brief Decoded command, @b name refers to the decoded buffer.
+ *     @b last_id is the id of the last message received from the opponent
+ *     (CHAT only), zero if the chat is not resumed. @b request_id is set
+ *     for tagged (binary) commands only.
+**/
+struct CommandView
+{
+    Command command = Command::BAD;
+    unsigned long count = 0;
+    std::string_view name = { };
+    uint64_t last_id = 0;
+    bool tagged = false;
+    uint64_t request_id = 0;
+};
+
+
+/**
+ * @brief Decodes text command sent by clients without binary protocol,
+ *     words are matched in one pass without allocation.
+**/
+CommandView decode_text_command(std::string_view input);
+
+
+/**
+ * @brief Decodes binary command without allocation, malformed commands
+ *     are @b Command::BAD .
+**/
+CommandView decode_binary_command(std::string_view body);
+
+
+/**
+ * @brief Encodes binary command, HELP and BAD are not encodable.
+**/
+std::string encode_binary_command(Command command, unsigned long count = 0, std::string_view name = { }, uint64_t last_id = 0);
+
+
+/**
+ * @brief Tags encoded binary command by @b request_id .
+**/
+std::string tag_binary_command(uint64_t request_id, const std::string& command);
+
+
+/**
+ * @brief Response to a tagged command is one packet: varint request id,
+ *     varint number of items and items prefixed by varint length. Items
+ *     are the packets of an untagged response without end-of-sequence.
+**/
+std::string encode_tagged_response(uint64_t request_id, std::span<const std::shared_ptr<const std::string>> items);
+
+
+/**
+ * @brief Decodes tagged response, @b items refer to the packet.
+**/
+bool decode_tagged_response(std::string_view body, uint64_t& request_id, std::vector<std::string_view>& items);
+
+
+/**
+ * @brief Splits long message into packets of at most @b chunk_size bytes,
+ *     all but the last one start with @b marker .
+**/
+std::vector<std::string> split_chunks(std::string_view msg, std::size_t chunk_size, std::string_view marker);
+
+
+/**
+ * @brief Encodes room message as "sender: msg". Chunk @b marker of @b msg
+ *     stays in front, so that clients join chunks of each sender apart.
+**/
+std::string encode_room_message(std::string_view sender, std::string_view msg, std::string_view marker);
+
+
+/**
+ * @brief Splits room message (without chunk marker) into @b sender and
+ *     @b text referring to @b body, false if there is no sender.
+**/
+bool decode_room_message(std::string_view body, std::string_view& sender, std::string_view& text);
+
+
+/**
+ * @brief Strips protocol tags appended to the user name upon log in,
+ *     @b binary and @b acks are set for recognized tags. The name refers
+ *     to @b msg .
+**/
+std::string_view split_log_in(std::string_view msg, bool& binary, bool& acks);
+
+
+/**
+ * @brief Parses decimal message id (digits only, no overflow).
+**/
+bool parse_message_id(std::string_view word, uint64_t& id);
+
+
+/**
+ * @brief Chat message sent with its id as @b id:body .
+**/
+std::string encode_chat_frame(uint64_t id, std::string_view body);
+
+
+/**
+ * @brief Splits chat frame into id and body, @b body refers to the frame.
+**/
+bool decode_chat_frame(std::string_view frame, uint64_t& id, std::string_view& body);
+
+
 /**
  * @brief Recognizes if string represents any valid Command.
 **/
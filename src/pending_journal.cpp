@@ -0,0 +1,236 @@
+#include <chrono>
+#include <cstring>
+#include "pending_journal.hpp"
+
+
+constexpr std::size_t PENDING_SEGMENT_SIZE = 16 << 20; // bytes of one log segment
+constexpr char OP_ENQUEUE = 'E';
+constexpr char OP_DEQUEUE = 'D';
+
+
+PendingJournal::PendingJournal()
+    : tracks_(), log_(), mutex_(), live_(), stop_(false), cond_(), compactor_()
+{
+}
+
+auto PendingJournal::encode(char op, uint64_t seq, const UserPair& key, std::string_view msg) -> std::string
+{
+    std::string result;
+    result.reserve(1 + sizeof(seq) + 2 * sizeof(uint32_t) + key.first.size() + key.second.size() + msg.size());
+
+    result.push_back(op);
+    result.append(reinterpret_cast<const char*>(&seq), sizeof(seq));
+
+    for (auto&& user : { &key.first, &key.second }) {
+        uint32_t len = user->size();
+        result.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        result.append(*user);
+    }
+    result.append(msg);
+
+    return result;
+}
+
+auto PendingJournal::decode(std::string_view payload, char* op, uint64_t* seq, UserPair* key, std::string_view* msg) -> bool
+{
+    if (payload.size() < 1 + sizeof(*seq)) { return false; }
+
+    *op = payload[0];
+    std::memcpy(seq, payload.data() + 1, sizeof(*seq));
+    payload.remove_prefix(1 + sizeof(*seq));
+
+    for (auto&& user : { &key->first, &key->second }) {
+        uint32_t len;
+        if (payload.size() < sizeof(len)) { return false; }
+
+        std::memcpy(&len, payload.data(), sizeof(len));
+        payload.remove_prefix(sizeof(len));
+        if (payload.size() < len) { return false; }
+
+        user->assign(payload.substr(0, len));
+        payload.remove_prefix(len);
+    }
+
+    *msg = payload;
+    return true;
+}
+
+auto PendingJournal::add_live(uint32_t segment, std::ptrdiff_t cnt) -> void
+{
+    auto&& live = live_[segment];
+    live += cnt;
+    if (live == 0) { live_.erase(segment); }
+}
+
+auto PendingJournal::open(const std::string& dir, UserMap& users) -> std::size_t
+{
+    struct Replay
+    {
+        std::map<uint64_t, SegmentLog::Location> msgs;
+        std::optional<SegmentLog::Location> mark;
+        uint64_t delivered = 0;
+        uint64_t next_seq = 1;
+    };
+
+    log_ = std::make_unique<SegmentLog>(dir, "pending", PENDING_SEGMENT_SIZE);
+
+    std::map<UserPair, Replay> replay;
+
+    {
+        char op;
+        uint64_t seq;
+        UserPair key;
+        std::string_view msg;
+
+        // rewritten messages could be found twice, sequence numbers are unique
+        log_->recover([&](SegmentLog::Location loc, std::string_view payload) {
+            if (!decode(payload, &op, &seq, &key, &msg)) { return; }
+
+            auto&& r = replay[key];
+            if (op == OP_ENQUEUE) { r.msgs[seq] = loc; }
+            if (op == OP_DEQUEUE && seq + 1 >= r.delivered) { r.delivered = seq + 1; r.mark = loc; }
+            r.next_seq = std::max(r.next_seq, seq + 1);
+        });
+    }
+
+    std::size_t cnt = 0;
+    std::lock_guard lock(mutex_);
+
+    for (auto&& [key, r] : replay) {
+        auto&& track = tracks_.observe(key);
+        auto&& pending = users.observe(key.first).get_pending().observe(key.second);
+        track.next_seq = r.next_seq;
+        track.mark = r.mark;
+        if (r.mark.has_value()) { add_live(r.mark->segment, 1); }
+
+        char op;
+        uint64_t seq;
+        UserPair k;
+        std::string_view msg;
+
+        // undelivered messages only, in the order of sequence numbers
+        for (auto it = r.msgs.lower_bound(r.delivered); it != r.msgs.end(); ++it) {
+            if (!decode(log_->read(it->second), &op, &seq, &k, &msg)) { continue; }
+
+            pending.push_back(PendingMessage{ .id = it->first, .body = std::make_shared<const Message>(msg) });
+            track.entries.push_back(Entry{ .seq = it->first, .loc = it->second });
+            add_live(it->second.segment, 1);
+            ++cnt;
+        }
+    }
+
+    compactor_ = std::thread([this]() { compact_loop(); });
+
+    return cnt;
+}
+
+auto PendingJournal::enqueue(const UserId& owner, const UserId& opponent, const Message& msg) -> uint64_t
+{
+    UserPair key(owner, opponent);
+    auto&& track = tracks_.observe(key);
+    std::lock_guard lock(track.mutex);
+
+    auto seq = track.next_seq++;
+    if (log_ == nullptr) { return seq; }
+
+    auto payload = encode(OP_ENQUEUE, seq, key, msg);
+
+    // live count is updated with the append, compaction never misses it
+    std::lock_guard live_lock(mutex_);
+    auto loc = log_->append(payload);
+    track.entries.push_back(Entry{ .seq = seq, .loc = loc });
+    add_live(loc.segment, 1);
+
+    return seq;
+}
+
+auto PendingJournal::dequeue(const UserId& owner, const UserId& opponent, uint64_t last_id) -> void
+{
+    if (log_ == nullptr) { return; }
+
+    UserPair key(owner, opponent);
+    auto&& track = tracks_.observe(key);
+    std::lock_guard lock(track.mutex);
+
+    std::size_t cnt = 0;
+    while (cnt < track.entries.size() && track.entries[cnt].seq <= last_id) { ++cnt; }
+    if (cnt == 0) { return; }
+
+    auto payload = encode(OP_DEQUEUE, track.entries[cnt - 1].seq, key, { });
+
+    // the new mark replaces the previous one
+    std::lock_guard live_lock(mutex_);
+    for (std::size_t i = 0; i < cnt; ++i) { add_live(track.entries[i].loc.segment, -1); }
+    if (track.mark.has_value()) { add_live(track.mark->segment, -1); }
+
+    track.entries.erase(track.entries.begin(), track.entries.begin() + cnt);
+    track.mark = log_->append(payload);
+    add_live(track.mark->segment, 1);
+}
+
+auto PendingJournal::evacuate(uint32_t segment) -> void
+{
+    for (auto&& key : tracks_.keys()) {
+        auto&& track = tracks_.observe(key);
+        std::lock_guard lock(track.mutex);
+
+        // the copy keeps its sequence number, hence its position
+        auto rewrite = [&](SegmentLog::Location& loc) {
+            if (loc.segment != segment) { return; }
+
+            std::lock_guard live_lock(mutex_);
+            auto copy = log_->append(log_->read(loc));
+            add_live(loc.segment, -1);
+            add_live(copy.segment, 1);
+            loc = copy;
+        };
+
+        for (auto&& entry : track.entries) { rewrite(entry.loc); }
+        if (track.mark.has_value()) { rewrite(*track.mark); }
+    }
+}
+
+auto PendingJournal::compact() -> void
+{
+    auto drop = [&]() {
+        std::lock_guard lock(mutex_);
+        auto [first, last] = log_->get_segments();
+
+        auto keep = (live_.empty()) ? (last) : (std::min(live_.begin()->first, last));
+        if (keep > first) { log_->truncate_before(keep); }
+
+        return last - std::max(first, keep) + 1;
+    };
+
+    if (drop() <= MAX_SEGMENTS) { return; }
+
+    // copies shall be durable before the original is removed
+    evacuate(log_->get_segments().first);
+    log_->sync();
+    drop();
+}
+
+auto PendingJournal::compact_loop() -> void
+{
+    std::unique_lock lock(mutex_);
+
+    while (!stop_) {
+        cond_.wait_for(lock, std::chrono::milliseconds(COMPACT_PERIOD), [&]() { return stop_; });
+        if (stop_) { break; }
+
+        lock.unlock();
+        compact();
+        lock.lock();
+    }
+}
+
+PendingJournal::~PendingJournal()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+
+    if (compactor_.joinable()) { compactor_.join(); }
+}
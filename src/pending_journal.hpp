@@ -0,0 +1,128 @@
+#ifndef PENDING_JOURNAL_HPP_
+#define PENDING_JOURNAL_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares thread-safe PendingJournal.
+**/
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include "segment_log.hpp"
+#include "storage.hpp"
+
+
+/**
+ * @brief Thread-safe journal of pending messages persisted in an
+ *     append-only SegmentLog. Each enqueued message is a record with
+ *     its id (sequence number within its queue), delivery of a prefix of
+ *     a queue is a record (mark) with the id of the last delivered message.
+ *
+ * @note Ids are allocated even if the journal is inactive (not opened),
+ *     nothing is persisted then. A background thread removes segments
+ *     without live records (undelivered messages and the latest mark of
+ *     each queue), live records of the oldest segment are rewritten once
+ *     there are too many segments, so that ids survive restarts.
+**/
+class PendingJournal final
+{
+private:
+    struct Entry
+    {
+        uint64_t seq;
+        SegmentLog::Location loc;
+    };
+
+    /**
+     * @brief Undelivered journaled messages of one queue in queue order.
+    **/
+    struct Track
+    {
+        std::mutex mutex;
+        uint64_t next_seq = 1;
+        std::deque<Entry> entries;
+        std::optional<SegmentLog::Location> mark;
+    };
+
+    /**
+     * @brief Queues are keyed by (owner, opponent), as in @b UserMap.
+    **/
+    using TrackMap = ShardedMapStorage<UserPair, Track, GLOBAL_MAP_SHARDS>;
+
+    static constexpr int64_t COMPACT_PERIOD = 1000;
+    static constexpr uint32_t MAX_SEGMENTS = 4;
+
+    TrackMap tracks_;
+    std::unique_ptr<SegmentLog> log_;
+
+    std::mutex mutex_;
+    std::map<uint32_t, std::size_t> live_;
+    bool stop_;
+    std::condition_variable cond_;
+    std::thread compactor_;
+
+    /**
+     * @brief Record payload is [op][seq][len owner][owner][len opponent]
+     *     [opponent][message], integers are in host byte order.
+    **/
+    static std::string encode(char op, uint64_t seq, const UserPair& key, std::string_view msg);
+    static bool decode(std::string_view payload, char* op, uint64_t* seq, UserPair* key, std::string_view* msg);
+
+    void add_live(uint32_t segment, std::ptrdiff_t cnt);
+
+    /**
+     * @brief Rewrites live records of the @b segment at the end of the log.
+    **/
+    void evacuate(uint32_t segment);
+
+    /**
+     * @brief Removes leading segments without live messages, evacuates
+     *     the oldest one if the log is too long.
+    **/
+    void compact();
+
+    void compact_loop();
+
+public:
+    PendingJournal();
+
+    /**
+     * @brief Activates the journal, log segments are kept in @b dir.
+     *     Undelivered messages are replayed to pending queues of @b users
+     *     in the original order. Throws @b std::runtime_error if the log
+     *     cannot be used.
+     *
+     * @return Number of replayed messages.
+    **/
+    std::size_t open(const std::string& dir, UserMap& users);
+
+    /**
+     * @brief Journals a message for @b owner from @b opponent, shall be
+     *     called before the message is pushed to the pending queue.
+     *
+     * @return Id of the message.
+    **/
+    uint64_t enqueue(const UserId& owner, const UserId& opponent, const Message& msg);
+
+    /**
+     * @brief Journals delivery of messages up to @b last_id (inclusive)
+     *     from the pending queue of @b owner from @b opponent.
+    **/
+    void dequeue(const UserId& owner, const UserId& opponent, uint64_t last_id);
+
+    PendingJournal(PendingJournal&&) = delete;
+    PendingJournal(const PendingJournal&) = delete;
+    PendingJournal& operator=(PendingJournal&&) = delete;
+    PendingJournal& operator=(const PendingJournal&) = delete;
+    ~PendingJournal();
+};
+
+
+#endif
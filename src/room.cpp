@@ -0,0 +1,94 @@
+#include <chrono>
+#include "message.hpp"
+#include "room.hpp"
+#include "session.hpp"
+
+
+Room::Room()
+    : mutex_(), members_(), index_(), last_id_(0)
+{
+    last_id_ = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+auto Room::join(const UserId& user, PendingDeque& pending) -> bool
+{
+    std::lock_guard lock(mutex_);
+
+    if (!index_.emplace(user, members_.size()).second) { return false; }
+
+    members_.push_back(Member{ .user = user, .pending = &pending });
+    return true;
+}
+
+auto Room::leave(const UserId& user) -> bool
+{
+    std::lock_guard lock(mutex_);
+
+    auto it = index_.find(user);
+    if (it == index_.end()) { return false; }
+
+    // the last member takes the place of the leaving one
+    auto pos = it->second;
+    index_.erase(it);
+
+    if (pos + 1 < members_.size()) {
+        members_[pos] = std::move(members_.back());
+        index_[members_[pos].user] = pos;
+    }
+    members_.pop_back();
+    return true;
+}
+
+auto Room::publish(const UserId& sender, const MessageRef& body, History& history, const UserPair& key) -> std::size_t
+{
+    std::size_t cnt = 0;
+
+    // publishers are serialized, so that ids are monotonic in every queue
+    // and the history keeps the order of ids
+    std::lock_guard lock(mutex_);
+    history.push_back(key, { body });
+
+    auto id = ++last_id_;
+    auto frame = std::make_shared<const Message>(encode_chat_frame(id, *body));
+
+    for (auto&& member : members_) {
+        if (member.user == sender) { continue; }
+
+        member.pending->push_back(PendingMessage{ .id = id, .body = body, .frame = frame });
+        ++cnt;
+    }
+
+    return cnt;
+}
+
+
+Rooms::Rooms()
+    : rooms_(), history_()
+{
+}
+
+auto Rooms::open(const std::string& dir, std::size_t capacity) -> std::size_t
+{
+    return history_.open(dir, capacity);
+}
+
+auto Rooms::join(const UserId& room, const UserId& user, PendingDeque& pending) -> bool
+{
+    return rooms_.observe(room).join(user, pending);
+}
+
+auto Rooms::leave(const UserId& room, const UserId& user) -> bool
+{
+    return rooms_.observe(room).leave(user);
+}
+
+auto Rooms::publish(const UserId& room, const UserId& sender, std::string_view msg) -> std::size_t
+{
+    MessageRef ref = std::make_shared<const Message>(encode_room_message(sender, msg, CHUNK_SYMBOL));
+    return rooms_.observe(room).publish(sender, ref, history_, { room, UserId() });
+}
+
+auto Rooms::get_last_n(const UserId& room, std::size_t n) -> std::vector<MessageRef>
+{
+    return history_.get_last_n({ room, UserId() }, n);
+}
@@ -0,0 +1,117 @@
+#ifndef ROOM_HPP_
+#define ROOM_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares group chat rooms.
+**/
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "history.hpp"
+#include "storage.hpp"
+
+
+/**
+ * @brief Thread-safe room with its members. Each member receives room
+ *     messages in its own pending queue for the room.
+ *
+ * @note Ids of room messages are shared by all members, they continue
+ *     from the wall clock (microseconds) upon room creation, so that they
+ *     keep growing across restarts.
+**/
+class Room final
+{
+private:
+    struct Member
+    {
+        UserId user;
+        PendingDeque* pending;
+    };
+
+    std::mutex mutex_;
+    std::vector<Member> members_;
+    std::unordered_map<UserId, std::size_t> index_;
+    uint64_t last_id_;
+
+public:
+    Room();
+
+    /**
+     * @brief Adds @b user with its @b pending queue, returns false if
+     *     the user is a member already.
+    **/
+    bool join(const UserId& user, PendingDeque& pending);
+
+    /**
+     * @brief Removes @b user, returns false if the user is not a member.
+    **/
+    bool leave(const UserId& user);
+
+    /**
+     * @brief Fans out @b body to all members but the @b sender. Members
+     *     receive handles of the same buffers (body and id:body frame),
+     *     @b history stores the body under @b key in the order of ids.
+     *
+     * @return Number of receivers.
+    **/
+    std::size_t publish(const UserId& sender, const MessageRef& body, History& history, const UserPair& key);
+
+    Room(Room&&) = delete;
+    Room(const Room&) = delete;
+    Room& operator=(Room&&) = delete;
+    Room& operator=(const Room&) = delete;
+};
+
+
+using RoomMap = ShardedMapStorage<UserId, Room, GLOBAL_MAP_SHARDS>;
+
+
+/**
+ * @brief Thread-safe registry of rooms together with their History,
+ *     stored once per room under the pair (room, empty name).
+ *
+ * @note Membership is kept in memory only, room history is persisted if
+ *     @b open is called.
+**/
+class Rooms final
+{
+private:
+    RoomMap rooms_;
+    History history_;
+
+public:
+    Rooms();
+
+    /**
+     * @brief Persists room history in @b dir, see @b History::open .
+    **/
+    std::size_t open(const std::string& dir, std::size_t capacity);
+
+    bool join(const UserId& room, const UserId& user, PendingDeque& pending);
+    bool leave(const UserId& room, const UserId& user);
+
+    /**
+     * @brief Publishes @b msg of @b sender as "sender: msg" (chunk marker
+     *     stays in front), the message is encoded once and goes to the
+     *     room history.
+     *
+     * @return Number of receivers.
+    **/
+    std::size_t publish(const UserId& room, const UserId& sender, std::string_view msg);
+
+    std::vector<MessageRef> get_last_n(const UserId& room, std::size_t n);
+
+    Rooms(Rooms&&) = delete;
+    Rooms(const Rooms&) = delete;
+    Rooms& operator=(Rooms&&) = delete;
+    Rooms& operator=(const Rooms&) = delete;
+};
+
+
+#endif
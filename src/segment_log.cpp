@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "segment_log.hpp"
+#include "utility.hpp"
+
+
+SegmentLog::SegmentLog(const std::string& dir, const std::string& prefix, std::size_t segment_size)
+    : dir_(dir), prefix_(prefix), segment_size_(segment_size), segments_mutex_(), segments_(), first_(0), mutex_(), offset_(0), appended_(0), durable_(0), stop_(false), cond_(), durable_cond_(), flusher_()
+{
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+
+    if (!std::filesystem::is_directory(dir_, ec)) {
+        throw std::runtime_error("Log directory " + dir_ + " cannot be used.");
+    }
+
+    flusher_ = std::thread([this]() { flush_loop(); });
+}
+
+auto SegmentLog::get_path(uint32_t id) const -> std::string
+{
+    // at least 8 digits, wider ids take up to 10
+    char name[32];
+    std::snprintf(name, sizeof(name), "-%08u.log", id);
+    return dir_ + '/' + prefix_ + name;
+}
+
+auto SegmentLog::open_segment(uint32_t id, std::size_t size) -> std::unique_ptr<Segment>
+{
+    auto path = get_path(id);
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        throw std::runtime_error("Log segment " + path + " cannot be opened.");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        throw std::runtime_error("Log segment " + path + " cannot be inspected.");
+    }
+
+    // existing segments keep their size, new ones are zero-filled
+    if (st.st_size == 0 && ftruncate(fd, size) == -1) {
+        close(fd);
+        throw std::runtime_error("Log segment " + path + " cannot be allocated.");
+    }
+    if (st.st_size != 0) { size = st.st_size; }
+
+    // segment is written via descriptor and read via mapping (shared page cache)
+    auto data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Log segment " + path + " cannot be mapped.");
+    }
+
+    return std::make_unique<Segment>(Segment{ .id = id, .fd = fd, .data = static_cast<uint8_t*>(data), .size = size });
+}
+
+auto SegmentLog::roll(std::size_t len) -> void
+{
+    auto id = segments_.empty() ? 0 : segments_.back()->id + 1;
+
+    // records never leave a segment before the following one is started
+    if (!segments_.empty() && appended_ > durable_) {
+        fdatasync(segments_.back()->fd);
+    }
+
+    auto segment = open_segment(id, std::max(segment_size_, len));
+
+    std::unique_lock lock(segments_mutex_);
+    if (segments_.empty()) { first_ = id; }
+    segments_.push_back(std::move(segment));
+    offset_ = 0;
+}
+
+auto SegmentLog::get_segment(uint32_t id) const -> const Segment*
+{
+    std::shared_lock lock(segments_mutex_);
+
+    if (id < first_ || id - first_ >= segments_.size()) { return nullptr; }
+    return segments_[id - first_].get();
+}
+
+auto SegmentLog::recover(const std::function<void(Location, std::string_view)>& visit) -> std::size_t
+{
+    std::vector<uint32_t> ids;
+
+    // segment files are named prefix-N.log, N has at least 8 digits and
+    // grows up to 10 digits (full uint32_t range)
+    for (auto&& entry : std::filesystem::directory_iterator(dir_)) {
+        auto name = entry.path().filename().string();
+        auto head = prefix_ + '-';
+
+        if (name.size() < head.size() + 12 || name.size() > head.size() + 14 || !name.starts_with(head) || !name.ends_with(".log")) { continue; }
+
+        auto num = name.substr(head.size(), name.size() - head.size() - 4);
+        if (!std::all_of(num.begin(), num.end(), [](char c) { return std::isdigit(c); })) { continue; }
+
+        auto id = std::stoull(num);
+        if (id > UINT32_MAX) {
+            throw std::runtime_error("Log segment " + name + " in " + dir_ + " has out-of-range id.");
+        }
+        ids.push_back(static_cast<uint32_t>(id));
+    }
+
+    std::sort(ids.begin(), ids.end());
+
+    for (std::size_t i = 1; i < ids.size(); ++i) {
+        if (ids[i] != ids[i - 1] + 1) {
+            throw std::runtime_error("Log segments in " + dir_ + " are not contiguous.");
+        }
+    }
+
+    std::lock_guard lock(mutex_);
+
+    std::size_t cnt = 0;
+    bool torn = false;
+
+    for (auto id : ids) {
+        auto segment = open_segment(id, segment_size_);
+        std::size_t off = 0;
+        torn = false;
+
+        // the first zero length, out-of-bounds length or checksum mismatch ends the segment
+        for (;;) {
+            uint32_t hdr[2];
+            if (off + HEADER_SIZE > segment->size) { break; }
+
+            std::memcpy(hdr, segment->data + off, HEADER_SIZE);
+            auto [len, crc] = std::pair(hdr[0], hdr[1]);
+
+            torn = (len != 0);
+            if (len == 0 || off + HEADER_SIZE + len > segment->size) { break; }
+
+            auto payload = segment->data + off + HEADER_SIZE;
+            if (crc32(payload, len) != crc) { break; }
+
+            visit(Location{ .segment = id, .offset = static_cast<uint32_t>(off) },
+                std::string_view(reinterpret_cast<const char*>(payload), len));
+
+            off += HEADER_SIZE + len;
+            ++cnt;
+            torn = false;
+        }
+
+        std::unique_lock segments_lock(segments_mutex_);
+        if (segments_.empty()) { first_ = id; }
+        segments_.push_back(std::move(segment));
+        offset_ = off;
+    }
+
+    // never overwrite a corrupted tail, stale records could be revived behind
+    if (segments_.empty() || torn) { roll(0); }
+
+    return cnt;
+}
+
+auto SegmentLog::append(std::string_view payload) -> Location
+{
+    uint32_t hdr[2] = { static_cast<uint32_t>(payload.size()), crc32(reinterpret_cast<const uint8_t*>(payload.data()), payload.size()) };
+    auto len = HEADER_SIZE + payload.size();
+
+    std::lock_guard lock(mutex_);
+
+    if (offset_ + len > segments_.back()->size) { roll(len); }
+
+    auto&& segment = *segments_.back();
+    iovec iov[2] = {
+        { .iov_base = hdr, .iov_len = HEADER_SIZE },
+        { .iov_base = const_cast<char*>(payload.data()), .iov_len = payload.size() }
+    };
+
+    std::size_t done = 0;
+    while (done < len) {
+        auto cnt = pwritev(segment.fd, iov, 2, offset_ + done);
+        if (cnt <= 0) {
+            if (cnt == -1 && errno == EINTR) { continue; }
+            throw std::runtime_error("Log segment " + get_path(segment.id) + " cannot be written.");
+        }
+
+        // rare partial write, shift vectors past written bytes
+        done += cnt;
+        for (auto&& v : iov) {
+            auto skip = std::min(v.iov_len, static_cast<std::size_t>(cnt));
+            v.iov_base = static_cast<char*>(v.iov_base) + skip;
+            v.iov_len -= skip;
+            cnt -= skip;
+        }
+    }
+
+    Location loc{ .segment = segment.id, .offset = static_cast<uint32_t>(offset_) };
+    offset_ += len;
+    ++appended_;
+
+    return loc;
+}
+
+auto SegmentLog::sync() -> void
+{
+    std::unique_lock lock(mutex_);
+
+    auto target = appended_;
+    cond_.notify_one();
+    durable_cond_.wait(lock, [&]() { return durable_ >= target || stop_; });
+}
+
+auto SegmentLog::read(Location loc) const -> std::string_view
+{
+    auto segment = get_segment(loc.segment);
+    if (segment == nullptr || loc.offset + HEADER_SIZE > segment->size) { return { }; }
+
+    uint32_t len;
+    std::memcpy(&len, segment->data + loc.offset, sizeof(len));
+    if (loc.offset + HEADER_SIZE + len > segment->size) { return { }; }
+
+    return std::string_view(reinterpret_cast<const char*>(segment->data + loc.offset + HEADER_SIZE), len);
+}
+
+auto SegmentLog::get_segments() const -> std::pair<uint32_t, uint32_t>
+{
+    std::shared_lock lock(segments_mutex_);
+    return { first_, first_ + static_cast<uint32_t>(segments_.size()) - 1 };
+}
+
+auto SegmentLog::truncate_before(uint32_t segment) -> void
+{
+    std::lock_guard lock(mutex_);
+    std::unique_lock segments_lock(segments_mutex_);
+
+    auto cnt = std::min<std::size_t>(segment - std::min(segment, first_), segments_.size() - 1);
+
+    for (std::size_t i = 0; i < cnt; ++i) {
+        munmap(segments_[i]->data, segments_[i]->size);
+        close(segments_[i]->fd);
+        unlink(get_path(segments_[i]->id).c_str());
+    }
+
+    segments_.erase(segments_.begin(), segments_.begin() + cnt);
+    first_ += cnt;
+}
+
+auto SegmentLog::flush_loop() -> void
+{
+    std::unique_lock lock(mutex_);
+
+    while (!stop_ || appended_ > durable_) {
+        // woken up early by sync and stop
+        if (!stop_) { cond_.wait_for(lock, std::chrono::milliseconds(COMMIT_PERIOD)); }
+
+        if (appended_ == durable_) { continue; }
+
+        // one sync covers all records appended so far (group commit)
+        auto target = appended_;
+        auto fd = segments_.back()->fd;
+
+        lock.unlock();
+        fdatasync(fd);
+        lock.lock();
+
+        durable_ = std::max(durable_, target);
+        durable_cond_.notify_all();
+    }
+}
+
+SegmentLog::~SegmentLog()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+
+    if (flusher_.joinable()) { flusher_.join(); }
+
+    durable_cond_.notify_all();
+
+    for (auto&& segment : segments_) {
+        munmap(segment->data, segment->size);
+        close(segment->fd);
+    }
+}
@@ -0,0 +1,155 @@
+#ifndef SEGMENT_LOG_HPP_
+#define SEGMENT_LOG_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares thread-safe append-only log SegmentLog.
+**/
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+/**
+ * @brief Thread-safe write-ahead, append-only log of opaque records split
+ *     into fixed-size memory-mapped segment files. A record consists of
+ *     the length of a payload, its CRC-32 checksum and the payload itself
+ *     (host byte order).
+ *
+ * @note Appended records are made durable in groups by a background
+ *     thread calling @b fdatasync periodically (group commit).
+**/
+class SegmentLog final
+{
+public:
+
+    /**
+     * @brief Position of a record within the log.
+    **/
+    struct Location
+    {
+        uint32_t segment;
+        uint32_t offset;
+    };
+
+private:
+    struct Segment
+    {
+        uint32_t id;
+        int fd;
+        uint8_t* data;
+        std::size_t size;
+    };
+
+    static constexpr std::size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+    static constexpr int64_t COMMIT_PERIOD = 10;
+
+    std::string dir_;
+    std::string prefix_;
+    std::size_t segment_size_;
+
+    mutable std::shared_mutex segments_mutex_;
+    std::vector<std::unique_ptr<Segment>> segments_;
+    uint32_t first_;
+
+    std::mutex mutex_;
+    std::size_t offset_;
+    uint64_t appended_;
+    uint64_t durable_;
+    bool stop_;
+    std::condition_variable cond_;
+    std::condition_variable durable_cond_;
+    std::thread flusher_;
+
+    std::string get_path(uint32_t id) const;
+
+    /**
+     * @brief Opens (creates if necessary) segment file and maps it.
+     *     Throws @b std::runtime_error upon failure.
+    **/
+    std::unique_ptr<Segment> open_segment(uint32_t id, std::size_t size);
+
+    /**
+     * @brief Appends new empty segment able to accommodate @b len bytes.
+     *
+     * @note Shall be called with locked @b mutex_.
+    **/
+    void roll(std::size_t len);
+
+    /**
+     * @brief Thread-safe segment lookup by its id.
+    **/
+    const Segment* get_segment(uint32_t id) const;
+
+    /**
+     * @brief Background group commit.
+    **/
+    void flush_loop();
+
+public:
+
+    /**
+     * @brief Opens the log in @b dir, segment files are @b prefix-N.log .
+     *     Throws @b std::runtime_error if directory cannot be used.
+    **/
+    SegmentLog(const std::string& dir, const std::string& prefix, std::size_t segment_size);
+
+    /**
+     * @brief Scans all segments and visits valid records in the order of
+     *     appending, the first torn or corrupted record ends a segment.
+     *     Shall be called once before any @b append.
+     *
+     * @return Number of visited records.
+    **/
+    std::size_t recover(const std::function<void(Location, std::string_view)>& visit);
+
+    /**
+     * @brief Thread-safe append of a record, durable after the next group
+     *     commit.
+    **/
+    Location append(std::string_view payload);
+
+    /**
+     * @brief Thread-safe blocking wait until all records appended so far
+     *     are durable.
+    **/
+    void sync();
+
+    /**
+     * @brief Thread-safe view of a record payload, view is valid as long as
+     *     the segment exists.
+    **/
+    std::string_view read(Location loc) const;
+
+    /**
+     * @brief Thread-safe ids of the oldest and the current segment.
+    **/
+    std::pair<uint32_t, uint32_t> get_segments() const;
+
+    /**
+     * @brief Thread-safe removal of all segments older than @b segment,
+     *     the current segment is never removed. Views of records within
+     *     removed segments become invalid.
+    **/
+    void truncate_before(uint32_t segment);
+
+    SegmentLog(SegmentLog&&) = delete;
+    SegmentLog(const SegmentLog&) = delete;
+    SegmentLog& operator=(SegmentLog&&) = delete;
+    SegmentLog& operator=(const SegmentLog&) = delete;
+    ~SegmentLog();
+};
+
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "coro.hpp"
+#include "server_coro.hpp"
+#include "server_session.hpp"
+
+
+constexpr int MAX_EVENTS = 64; // events retrieved by one epoll_wait
+
+
+struct CoroLoop::Connection
+{
+    ServerSession session;
+    uint64_t peer;
+    Task task;
+    std::coroutine_handle<> waiter; // suspended coroutine, if any
+    PendingDeque* subscribed;
+    uint32_t events;
+    bool pending;                   // waiter is resumed by notifications
+    bool notified;
+
+    Connection(int sock, uint64_t peer, UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger)
+        : session(sock, users, history, journal, rooms, logger), peer(peer), task(), waiter(), subscribed(nullptr), events(0), pending(false), notified(false)
+    {
+    }
+};
+
+
+CoroLoop::Wait::Wait(CoroLoop& loop, Connection& conn, uint32_t events, bool pending)
+    : loop_(loop), conn_(conn), events_(events), pending_(pending)
+{
+}
+
+auto CoroLoop::Wait::await_ready() const noexcept -> bool
+{
+    return pending_ && conn_.notified;
+}
+
+auto CoroLoop::Wait::await_suspend(std::coroutine_handle<> handle) -> void
+{
+    conn_.waiter = handle;
+    conn_.pending = pending_;
+    loop_.watch(conn_, events_);
+}
+
+auto CoroLoop::Wait::await_resume() noexcept -> bool
+{
+    auto notified = pending_ && conn_.notified;
+    if (notified) { conn_.notified = false; }
+    return notified;
+}
+
+
+CoroLoop::CoroLoop(UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger)
+    : epoll_(-1), wakeup_(-1), users_(users), history_(history), journal_(journal), rooms_(rooms), logger_(logger), mutex_(), adopted_(), notified_(), conns_()
+{
+    if ((epoll_ = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        throw std::runtime_error("CoroLoop cannot create epoll instance.");
+    }
+
+    if ((wakeup_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        close(epoll_);
+        throw std::runtime_error("CoroLoop cannot create wake up descriptor.");
+    }
+
+    epoll_event ev { .events = EPOLLIN, .data = { .fd = wakeup_ } };
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, wakeup_, &ev) == -1) {
+        close(wakeup_);
+        close(epoll_);
+        throw std::runtime_error("CoroLoop cannot watch wake up descriptor.");
+    }
+}
+
+auto CoroLoop::readable(int sock, bool pending) -> Wait
+{
+    return Wait(*this, *conns_.at(sock), EPOLLIN, pending);
+}
+
+auto CoroLoop::writable(int sock) -> Wait
+{
+    return Wait(*this, *conns_.at(sock), EPOLLOUT, false);
+}
+
+auto CoroLoop::subscribe(int sock, PendingDeque* pending) -> void
+{
+    auto&& conn = *conns_.at(sock);
+    if (conn.subscribed == pending) { return; }
+
+    if (conn.subscribed != nullptr) { conn.subscribed->subscribe(nullptr); }
+
+    // pushes to opponent's pending messages wake up the loop
+    if (pending != nullptr) { pending->subscribe([this, sock]() { notify(sock); }); }
+
+    conn.subscribed = pending;
+    conn.notified = false;
+}
+
+auto CoroLoop::adopt(int sock, uint64_t peer) -> void
+{
+    {
+        std::lock_guard lock(mutex_);
+        adopted_.emplace_back(sock, peer);
+    }
+    wake();
+}
+
+auto CoroLoop::wake() -> void
+{
+    uint64_t one = 1;
+    [[maybe_unused]] auto res = write(wakeup_, &one, sizeof(one));
+}
+
+auto CoroLoop::notify(int sock) -> void
+{
+    bool first;
+
+    {
+        std::lock_guard lock(mutex_);
+        first = notified_.empty();
+        notified_.push_back(sock);
+    }
+
+    // avoid excessive system calls upon bursts
+    if (first) { wake(); }
+}
+
+auto CoroLoop::on_wakeup() -> void
+{
+    std::vector<std::pair<int, uint64_t>> adopted;
+    std::vector<int> notified;
+
+    {
+        uint64_t cnt;
+        [[maybe_unused]] auto res = read(wakeup_, &cnt, sizeof(cnt));
+
+        std::lock_guard lock(mutex_);
+        adopted.swap(adopted_);
+        notified.swap(notified_);
+    }
+
+    for (auto sock : notified) {
+        auto it = conns_.find(sock);
+        if (it == conns_.end()) { continue; }
+
+        auto&& conn = *it->second;
+        conn.notified = true;
+        if (conn.waiter && conn.pending) { resume(conn); }
+    }
+
+    for (auto&& [sock, peer] : adopted) {
+        epoll_event ev { .events = 0, .data = { .fd = sock } };
+
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, sock, &ev) == -1) {
+            logger_.log(LogRecord(LogFormat::NOT_WATCHED, sock));
+            close(sock);
+            continue;
+        }
+
+        auto&& conn = *conns_.emplace(sock, std::make_unique<Connection>(sock, peer, users_, history_, journal_, rooms_, logger_)).first->second;
+
+        // the coroutine runs until its first suspension
+        conn.task = conn.session.serve_async(*this);
+        conn.task.start();
+        if (conn.task.done()) { release(sock); }
+    }
+}
+
+auto CoroLoop::resume(Connection& conn) -> void
+{
+    auto sock = conn.session.get_socket();
+
+    std::exchange(conn.waiter, {}).resume();
+    if (conn.task.done()) { release(sock); }
+}
+
+auto CoroLoop::watch(Connection& conn, uint32_t events) -> void
+{
+    if (events == conn.events) { return; }
+
+    conn.events = events;
+    epoll_event ev { .events = events, .data = { .fd = conn.session.get_socket() } };
+    epoll_ctl(epoll_, EPOLL_CTL_MOD, conn.session.get_socket(), &ev);
+}
+
+auto CoroLoop::release(int sock) -> void
+{
+    auto it = conns_.find(sock);
+    if (it == conns_.end()) { return; }
+
+    auto&& conn = *it->second;
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, sock, nullptr);
+
+    if (conn.subscribed != nullptr) { conn.subscribed->subscribe(nullptr); }
+
+    // suspended coroutine is destroyed, the session did not finish itself
+    if (!conn.task.done()) { conn.session.finish(); }
+
+    logger_.log(LogRecord(LogFormat::CLOSE_CONNECTION, conn.peer));
+    conns_.erase(it); // session closes the socket
+}
+
+auto CoroLoop::loop(const std::atomic_bool& done) -> void
+{
+    epoll_event events[MAX_EVENTS];
+
+    while (!done.load()) {
+        auto cnt = epoll_wait(epoll_, events, MAX_EVENTS, -1);
+
+        for (int i = 0; i < cnt; ++i) {
+            auto fd = events[i].data.fd;
+
+            if (fd == wakeup_) { on_wakeup(); continue; }
+
+            auto it = conns_.find(fd);
+            if (it == conns_.end()) { continue; }
+
+            // errors resume the waiter, which observes them on the socket
+            auto&& conn = *it->second;
+            if (conn.waiter && (events[i].events & (conn.events | EPOLLERR | EPOLLHUP))) { resume(conn); }
+        }
+    }
+
+    while (!conns_.empty()) { release(conns_.begin()->first); }
+}
+
+CoroLoop::~CoroLoop()
+{
+    for (auto&& [sock, peer] : adopted_) { close(sock); }
+
+    close(wakeup_);
+    close(epoll_);
+}
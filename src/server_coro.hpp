@@ -0,0 +1,145 @@
+#ifndef SERVER_CORO_HPP_
+#define SERVER_CORO_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares epoll-based event loop CoroLoop resuming
+ * session coroutines, used by Server in coro mode.
+**/
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "history.hpp"
+#include "log_record.hpp"
+#include "pending_journal.hpp"
+#include "room.hpp"
+#include "storage.hpp"
+
+
+/**
+ * @brief Event loop owning a set of non-blocking sockets, each served by
+ *     a ServerSession coroutine (@b serve_async). Coroutines suspend on
+ *     awaitables returned by @b readable and @b writable, and the loop
+ *     resumes them upon readiness events or pending message notifications.
+ *
+ * @note Sockets are passed from the accepting thread via thread-safe
+ *     @b adopt, all other methods run on the CoroLoop thread exclusively.
+**/
+class CoroLoop final
+{
+private:
+    struct Connection;
+
+    int epoll_;
+    int wakeup_;
+    UserMap& users_;
+    History& history_;
+    PendingJournal& journal_;
+    Rooms& rooms_;
+    ServerLogger& logger_;
+
+    std::mutex mutex_;
+    std::vector<std::pair<int, uint64_t>> adopted_;
+    std::vector<int> notified_;
+
+    std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+
+    /**
+     * @brief Starts coroutines of sockets passed from the accepting thread
+     *     and resumes notified ones waiting for pending messages.
+    **/
+    void on_wakeup();
+
+    /**
+     * @brief Resumes suspended coroutine, completed session is released.
+    **/
+    void resume(Connection& conn);
+
+    /**
+     * @brief Watches exactly @b events on the connection socket.
+    **/
+    void watch(Connection& conn, uint32_t events);
+
+    /**
+     * @brief Closes the socket, unfinished session is finished.
+    **/
+    void release(int sock);
+
+    /**
+     * @brief Thread-safe notification about new pending messages for the
+     *     session on @b sock, invoked by producers.
+    **/
+    void notify(int sock);
+
+public:
+
+    /**
+     * @brief Awaitable suspending a session coroutine until its socket is
+     *     ready. Resumes with true if pending messages woke it up instead.
+    **/
+    class Wait final
+    {
+    private:
+        CoroLoop& loop_;
+        Connection& conn_;
+        uint32_t events_;
+        bool pending_;
+
+    public:
+        Wait(CoroLoop& loop, Connection& conn, uint32_t events, bool pending);
+
+        bool await_ready() const noexcept;
+        void await_suspend(std::coroutine_handle<> handle);
+        bool await_resume() noexcept;
+    };
+
+    CoroLoop(UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger);
+
+    /**
+     * @brief Waits until @b sock is readable or, if @b pending is set,
+     *     until pending messages of the session are notified.
+    **/
+    Wait readable(int sock, bool pending);
+
+    /**
+     * @brief Waits until @b sock is writable.
+    **/
+    Wait writable(int sock);
+
+    /**
+     * @brief Subscribes the session on @b sock to notifications from
+     *     @b pending, nullptr unsubscribes.
+    **/
+    void subscribe(int sock, PendingDeque* pending);
+
+    /**
+     * @brief Thread-safe hand over of a freshly accepted non-blocking socket,
+     *     @b peer is packed by @b make_log_peer .
+    **/
+    void adopt(int sock, uint64_t peer);
+
+    /**
+     * @brief Thread-safe wake up of the event loop.
+    **/
+    void wake();
+
+    /**
+     * @brief Event loop, runs until @b done is set and CoroLoop is woken up.
+    **/
+    void loop(const std::atomic_bool& done);
+
+    CoroLoop(CoroLoop&&) = delete;
+    CoroLoop(const CoroLoop&) = delete;
+    CoroLoop& operator=(CoroLoop&&) = delete;
+    CoroLoop& operator=(const CoroLoop&) = delete;
+    ~CoroLoop();
+};
+
+
+#endif
@@ -1,128 +1,295 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstring>
+#include <filesystem>
 #include <iostream>
-#include <sstream>
 #include <thread>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include "server_coro.hpp"
+#include "server_proactor.hpp"
+#include "server_reactor.hpp"
 #include "server_session.hpp"
 #include "server_entity.hpp"
+#include "uring.hpp"
 #include "utility.hpp"
 
 
-constexpr int BACKLOG = 1; // max length of the accepting queue
+/**
+ * @brief Creates listening socket bound to @b port on all interfaces,
+ *     @b shared sockets are bound to the same port.
+**/
+static int open_listener(uint16_t port, int backlog, bool shared)
+{
+    auto sock = create_new_socket();
+
+    try {
+        allow_socket_reuse(sock);
+        if (shared) { allow_port_sharing(sock); }
+        // server socket blocks on accept!
+
+        sockaddr_in addr {
+            .sin_family = AF_INET,
+            .sin_port = htons(port),
+            .sin_addr = in_addr{htonl(INADDR_ANY)},
+            .sin_zero = {  }
+        };
+
+        // assign a name to the socket
+        if (bind(sock, (sockaddr *)&addr, sizeof(addr)) == -1) {
+            throw std::runtime_error("Socket cannot be bound.");
+        }
+
+        // mark socket as accepting connections
+        if (listen(sock, backlog) == -1) {
+            throw std::runtime_error("Socket cannot listen and accept.");
+        }
+    } catch (...) {
+        close(sock);
+        throw;
+    }
+
+    return sock;
+}
 
 
 Server::Server()
-    : Entity(), logger_(&std::cout)
+    : Entity(), log_file_(), logger_(&std::cout), users_(), history_(), journal_(), rooms_(), router_(), mode_(ServerMode::THREAD), workers_(1), listeners_()
 {
 }
 
 auto Server::init(const ServerArgsParser& args) -> void
 {
-    sock_ = create_new_socket();
-    allow_socket_reuse(*sock_);
-    // server socket blocks on accept!
-
-    sockaddr_in addr {
-        .sin_family = AF_INET,
-        .sin_port = htons(parse_port(args.get_value("port"))),
-        .sin_addr = in_addr{htonl(INADDR_ANY)},
-        .sin_zero = {  }
+    auto mode = args.get_value("mode");
+
+    if (mode == "thread") { mode_ = ServerMode::THREAD; }
+    else if (mode == "reactor") { mode_ = ServerMode::REACTOR; }
+    else if (mode == "uring") { mode_ = ServerMode::URING; }
+    else if (mode == "shard") { mode_ = ServerMode::SHARD; }
+    else if (mode == "coro") { mode_ = ServerMode::CORO; }
+    else { throw std::invalid_argument("Server mode shall be thread, reactor, uring, shard or coro."); }
+
+    // kernels without io_uring (or with io_uring disabled) fall back to epoll
+    if (mode_ == ServerMode::URING && !Uring::supported()) {
+        mode_ = ServerMode::REACTOR;
+
+        std::cout
+            << "io_uring is not supported, falling back to reactor mode."
+            << std::endl;
+    }
+
+    workers_ = parse_count(args.get_value("workers"));
+
+    // console is replaced by a rotating file
+    if (auto path = args.get_value("log-file"); !path.empty()) {
+        auto sync = args.get_value("log-sync");
+        log_file_ = std::make_unique<LogFile>(
+            path,
+            parse_limit(args.get_value("log-rotate-size")),
+            std::chrono::seconds(parse_limit(args.get_value("log-rotate-time"))),
+            std::chrono::milliseconds(sync.empty() ? 0 : parse_limit(sync))
+        );
+        logger_.set_stream(log_file_.get());
+    }
+
+    RecvBuffer::set_max_packet(parse_count(args.get_value("max-packet")));
+
+    auto retention = parse_count(args.get_value("retention"));
+    HistoryRing::set_default_capacity(retention);
+
+    // each shard persists its storage in its own subdirectory
+    if (mode_ == ServerMode::SHARD) { router_ = std::make_unique<ShardRouter>(workers_); }
+
+    auto shards = (router_ != nullptr) ? router_->count() : 1;
+    auto shard_dir = [&](const std::string& dir, std::size_t i) {
+        return (router_ != nullptr) ? (std::filesystem::path(dir) / ("shard-" + std::to_string(i))).string() : dir;
     };
 
-    // assign a name to the socket
-    if (bind(*sock_, (sockaddr *)&addr, sizeof(addr)) == -1) {
-        throw std::runtime_error("Socket cannot be bound.");
+    // history is rebuilt from log segments before accepting connections
+    if (auto dir = args.get_value("history-dir"); !dir.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        std::size_t cnt = 0;
+        for (std::size_t i = 0; i < shards; ++i) {
+            cnt += (router_ != nullptr)
+                ? router_->history(i).open(shard_dir(dir, i), retention)
+                : history_.open(dir, retention);
+        }
+
+        // rooms share one history in all modes
+        cnt += rooms_.open((std::filesystem::path(dir) / "rooms").string(), retention);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+        std::cout
+            << "History recovered "
+            << cnt
+            << " messages from "
+            << dir
+            << " in "
+            << elapsed.count()
+            << " ms."
+            << std::endl;
     }
 
-    // mark socket as accepting connections
-    if (listen(*sock_, BACKLOG) == -1) {
-        throw std::runtime_error("Socket cannot listen and accept.");
+    // undelivered messages are replayed to pending queues
+    if (auto dir = args.get_value("pending-dir"); !dir.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        std::size_t cnt = 0;
+        for (std::size_t i = 0; i < shards; ++i) {
+            cnt += (router_ != nullptr)
+                ? router_->journal(i).open(shard_dir(dir, i), router_->users(i))
+                : journal_.open(dir, users_);
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+        std::cout
+            << "Pending recovered "
+            << cnt
+            << " messages from "
+            << dir
+            << " in "
+            << elapsed.count()
+            << " ms."
+            << std::endl;
     }
 
-    std::cout
-        << "Server listens at socket "
-        << *sock_
-        << ", port "
-        << args.get_value("port")
-        << "."
-        << std::endl;
+    auto port = parse_port(args.get_value("port"));
+    auto backlog = static_cast<int>(std::min<std::size_t>(parse_count(args.get_value("backlog")), INT_MAX));
+    auto listeners = parse_count(args.get_value("listeners"));
+
+    // each listening socket has its own accept queue and accept loop
+    for (std::size_t i = 0; i < listeners; ++i) {
+        auto sock = open_listener(port, backlog, listeners > 1);
+        listeners_.push_back(sock);
+
+        std::cout
+            << "Server listens at socket "
+            << sock
+            << ", port "
+            << port
+            << "."
+            << std::endl;
+    }
 }
 
 auto Server::loop() -> void
 {
-    UserMap users;
-    HistoryMap history;
     std::atomic_bool done(false);
     std::vector<std::thread> services;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::vector<std::unique_ptr<Proactor>> proactors;
+    std::vector<std::unique_ptr<CoroLoop>> coro_loops;
 
     services.emplace_back([&]() { logger_.loop(done); });
 
-    while (!done.load()) {
-        sockaddr_in peer_addr;
-        socklen_t peer_addr_len = sizeof(peer_addr);
-
-        auto new_sock = accept(*sock_, (sockaddr *)&peer_addr, &peer_addr_len);
-
-        // new socket shall be configured as non-blocking
-        try {
-            set_socket_non_blocking(new_sock);
-        } catch (...) { close(new_sock); new_sock = -1; }
-
-        // broken connection
-        if (new_sock == -1) {
-            logger_.log(
-                (std::ostringstream()
-                    << "Error "
-                    << errno
-                    << " upon accepting new socket."
-                ).str()
-            );
+    // fixed number of event loops serves all connections
+    if (mode_ == ServerMode::REACTOR) {
+        for (std::size_t i = 0; i < workers_; ++i) {
+            auto&& reactor = reactors.emplace_back(std::make_unique<Reactor>(users_, history_, journal_, rooms_, logger_));
+            services.emplace_back([&, r = reactor.get()]() { r->loop(done); });
         }
+    }
 
-        // confirmed connection
-        else {
-            std::string addr;
+    // one pinned event loop per shard, shards wake up each other
+    if (mode_ == ServerMode::SHARD) {
+        for (std::size_t i = 0; i < workers_; ++i) {
+            auto&& reactor = reactors.emplace_back(std::make_unique<Reactor>(router_->users(i), router_->history(i), router_->journal(i), rooms_, logger_, router_.get(), i));
+            router_->set_wake(i, [r = reactor.get()]() { r->wake(); });
+        }
 
-            // decypher IP address
-            {
-                char buf[INET_ADDRSTRLEN];
-                inet_ntop(peer_addr.sin_family, &peer_addr, buf, INET_ADDRSTRLEN);
-                addr = buf;
+        for (std::size_t i = 0; i < workers_; ++i) {
+            auto&& service = services.emplace_back([&, r = reactors[i].get()]() { r->loop(done); });
+            if (!pin_thread(service, i)) {
+                std::cout
+                    << "Shard thread cannot be pinned to a core."
+                    << std::endl;
             }
+        }
+    }
 
-            // create new thread for new connection
-            std::thread thread([&, new_sock = new_sock, addr = addr, port = peer_addr.sin_port]() {
-                ServerSession conn(new_sock, users, history, logger_);
-
-                logger_.log(
-                    (std::ostringstream()
-                        << "New connection from peer "
-                        << addr
-                        << " port "
-                        << ntohs(port)
-                        << '.'
-                    ).str()
-                );
-
-                conn.serve();
-
-                logger_.log(
-                    (std::ostringstream()
-                        << "Closing connection with peer "
-                        << addr
-                        << " port "
-                        << ntohs(port)
-                        << '.'
-                    ).str()
-                );
-            });
-
-            thread.detach();
+    // sessions are coroutines sharing a fixed number of event loops
+    if (mode_ == ServerMode::CORO) {
+        for (std::size_t i = 0; i < workers_; ++i) {
+            auto&& coro_loop = coro_loops.emplace_back(std::make_unique<CoroLoop>(users_, history_, journal_, rooms_, logger_));
+            services.emplace_back([&, l = coro_loop.get()]() { l->loop(done); });
         }
     }
 
+    // event loops accept connections by themselves, each listener is served
+    // by at least one of them
+    if (mode_ == ServerMode::URING) {
+        for (std::size_t i = 0; i < workers_; ++i) {
+            std::vector<int> listeners;
+            for (auto j = i; j < listeners_.size(); j += workers_) { listeners.push_back(listeners_[j]); }
+            if (listeners.empty()) { listeners.push_back(listeners_[i % listeners_.size()]); }
+
+            auto&& proactor = proactors.emplace_back(std::make_unique<Proactor>(std::move(listeners), users_, history_, journal_, rooms_, logger_));
+            services.emplace_back([&, p = proactor.get()]() { p->loop(done); });
+        }
+    }
+
+    auto accept_loop = [&](int listener, std::size_t next_reactor) {
+        while (!done.load()) {
+            sockaddr_in peer_addr;
+            socklen_t peer_addr_len = sizeof(peer_addr);
+
+            // new socket shall be non-blocking (set by accept itself), without delays
+            auto new_sock = accept4(listener, (sockaddr *)&peer_addr, &peer_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            try {
+                if (new_sock != -1) { set_socket_no_delay(new_sock); }
+            } catch (...) { close(new_sock); new_sock = -1; }
+
+            // broken connection
+            if (new_sock == -1) {
+                logger_.log(LogRecord(LogFormat::ACCEPT_ERROR, errno));
+            }
+
+            // confirmed connection
+            else {
+                // IP address is decyphered on the logger thread
+                auto peer = make_log_peer(peer_addr);
+
+                logger_.log(LogRecord(LogFormat::NEW_CONNECTION, peer));
+
+                // hand over new connection to the next event loop
+                if (mode_ == ServerMode::REACTOR || mode_ == ServerMode::SHARD) {
+                    reactors[next_reactor]->adopt(new_sock, peer);
+                    next_reactor = (next_reactor + 1) % reactors.size();
+                }
+
+                else if (mode_ == ServerMode::CORO) {
+                    coro_loops[next_reactor]->adopt(new_sock, peer);
+                    next_reactor = (next_reactor + 1) % coro_loops.size();
+                }
+
+                // create new thread for new connection
+                else {
+                    std::thread thread([&, new_sock = new_sock, peer = peer]() {
+                        ServerSession conn(new_sock, users_, history_, journal_, rooms_, logger_);
+                        conn.serve();
+                        logger_.log(LogRecord(LogFormat::CLOSE_CONNECTION, peer));
+                    });
+
+                    thread.detach();
+                }
+            }
+        }
+    };
+
+    // one accept loop per listening socket, the first one runs on the main thread
+    if (mode_ != ServerMode::URING) {
+        for (std::size_t i = 1; i < listeners_.size(); ++i) {
+            services.emplace_back([&, i]() { accept_loop(listeners_[i], i % workers_); });
+        }
+        accept_loop(listeners_[0], 0);
+    }
+
+    for (auto&& reactor : reactors) { reactor->wake(); }
+    for (auto&& proactor : proactors) { proactor->wake(); }
+    for (auto&& coro_loop : coro_loops) { coro_loop->wake(); }
+
     for (auto&& service : services) {
         if (service.joinable()) {
             service.join();
@@ -132,6 +299,8 @@ auto Server::loop() -> void
 
 Server::~Server()
 {
+    for (auto sock : listeners_) { close(sock); }
+
     std::cout
         << "Server goes down..."
         << std::endl;
@@ -3,7 +3,12 @@
 
 #include "args.hpp"
 #include "entity.hpp"
-#include "logger.hpp"
+#include "history.hpp"
+#include "log_file.hpp"
+#include "log_record.hpp"
+#include "pending_journal.hpp"
+#include "room.hpp"
+#include "server_shard.hpp"
 #include "storage.hpp"
 
 
@@ -14,12 +19,38 @@
 **/
 
 
+/**
+ * @brief Connections are served either by a dedicated thread each or by
+ *     a fixed number of event loops, readiness-based (Reactors) or
+ *     completion-based (Proactors on io_uring). In shard mode, each
+ *     Reactor is pinned to a core and owns a shard of users. In coro
+ *     mode, sessions are coroutines resumed by CoroLoops.
+**/
+enum class ServerMode
+{
+    THREAD,
+    REACTOR,
+    URING,
+    SHARD,
+    CORO
+};
+
+
 /**
  * @brief Server class.
 **/
 class Server final : public Entity {
 private:
-    Logger<std::string> logger_;
+    std::unique_ptr<LogFile> log_file_;
+    ServerLogger logger_;
+    UserMap users_;
+    History history_;
+    PendingJournal journal_;
+    Rooms rooms_;
+    std::unique_ptr<ShardRouter> router_;
+    ServerMode mode_;
+    std::size_t workers_;
+    std::vector<int> listeners_;
 
 public:
     Server();
@@ -30,8 +61,11 @@ public:
     void init(const ServerArgsParser& args);
 
     /**
-     * @brief Main Server endless loop accepting incoming connections.
-     *     Connections are served by ServerSession instances.
+     * @brief Main Server endless loop accepting incoming connections, one
+     *     accept loop per listening socket.
+     *     Connections are served by ServerSession instances, either on
+     *     dedicated threads or on Reactor event loops. Proactors accept
+     *     connections by themselves.
     **/
     void loop() override;
 
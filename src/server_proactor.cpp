@@ -0,0 +1,402 @@
+#include <cerrno>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "server_proactor.hpp"
+#include "server_session.hpp"
+#include "uring.hpp"
+#include "utility.hpp"
+
+
+constexpr unsigned RING_ENTRIES = 256;    // submission ring size
+constexpr unsigned BUFFER_COUNT = 256;    // provided receive buffers, power of two
+constexpr unsigned BUFFER_SIZE = 16 << 10;
+
+/**
+ * @brief Operation kinds encoded in the lowest bits of user data, the rest
+ *     is the address of the connection (if any) or the listener index.
+**/
+enum : uint64_t
+{
+    OP_ACCEPT = 0,
+    OP_WAKEUP,
+    OP_RECV,
+    OP_SEND,
+    OP_CANCEL,
+    OP_MASK = 7
+};
+
+
+struct Proactor::Connection
+{
+    ServerSession session;
+    uint64_t peer;
+    PendingDeque* subscribed;
+    msghdr msg;
+    unsigned ops;   // submitted operations not completed yet
+    bool reading;   // buffered packets are handled
+    bool receiving; // recv is armed
+    bool sending;   // send is in flight
+    bool broken;
+    bool closing;
+
+    Connection(int sock, uint64_t peer, UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger)
+        : session(sock, users, history, journal, rooms, logger), peer(peer), subscribed(nullptr), msg(), ops(0), reading(true), receiving(false), sending(false), broken(false), closing(false)
+    {
+    }
+
+    uint64_t user_data(uint64_t op) { return reinterpret_cast<uint64_t>(this) | op; }
+};
+
+
+Proactor::Proactor(std::vector<int> listeners, UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger)
+    : listeners_(std::move(listeners)), wakeup_(-1), wakeup_value_(0), ring_(nullptr), multishot_recv_(true), stopping_(false), users_(users), history_(history), journal_(journal), rooms_(rooms), logger_(logger),
+      mutex_(), notified_(), conns_(), chats_(), ready_()
+{
+    // blocking descriptor, io_uring polls it by itself
+    if ((wakeup_ = eventfd(0, EFD_CLOEXEC)) == -1) {
+        throw std::runtime_error("Proactor cannot create wake up descriptor.");
+    }
+}
+
+auto Proactor::wake() -> void
+{
+    uint64_t one = 1;
+    [[maybe_unused]] auto res = write(wakeup_, &one, sizeof(one));
+}
+
+auto Proactor::notify(int sock) -> void
+{
+    bool first;
+
+    {
+        std::lock_guard lock(mutex_);
+        first = notified_.empty();
+        notified_.push_back(sock);
+    }
+
+    // avoid excessive system calls upon bursts
+    if (first) { wake(); }
+}
+
+auto Proactor::arm_accept(std::size_t idx) -> void
+{
+    auto sqe = ring_->get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listeners_[idx];
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (idx << 3) | OP_ACCEPT;
+}
+
+auto Proactor::arm_wakeup() -> void
+{
+    auto sqe = ring_->get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeup_;
+    sqe->addr = reinterpret_cast<uint64_t>(&wakeup_value_);
+    sqe->len = sizeof(wakeup_value_);
+    sqe->user_data = OP_WAKEUP;
+}
+
+auto Proactor::arm_recv(Connection& conn) -> void
+{
+    auto sqe = ring_->get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn.session.get_socket();
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = Uring::BUFFER_GROUP;
+    sqe->ioprio = multishot_recv_ ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = conn.user_data(OP_RECV);
+
+    ++conn.ops;
+    conn.receiving = true;
+}
+
+auto Proactor::cancel_recv(Connection& conn) -> void
+{
+    if (!conn.receiving) { return; }
+
+    auto sqe = ring_->get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = conn.user_data(OP_RECV);
+    sqe->user_data = conn.user_data(OP_CANCEL);
+
+    ++conn.ops;
+}
+
+auto Proactor::on_accept(std::size_t idx, int res, uint32_t flags) -> void
+{
+    // multishot accept could be terminated by the kernel
+    if (!(flags & IORING_CQE_F_MORE) && !stopping_) { arm_accept(idx); }
+
+    if (res < 0) {
+        logger_.log(LogRecord(LogFormat::ACCEPT_ERROR, -res));
+        return;
+    }
+
+    auto sock = res;
+
+    if (stopping_) { close(sock); return; }
+
+    sockaddr_in peer_addr {};
+    socklen_t peer_addr_len = sizeof(peer_addr);
+
+    // new socket shall be configured without delays
+    try {
+        set_socket_no_delay(sock);
+        if (getpeername(sock, (sockaddr *)&peer_addr, &peer_addr_len) == -1) { throw std::runtime_error("Peer is unknown."); }
+    } catch (...) {
+        logger_.log(LogRecord(LogFormat::ACCEPT_ERROR, errno));
+        close(sock);
+        return;
+    }
+
+    auto peer = make_log_peer(peer_addr);
+    logger_.log(LogRecord(LogFormat::NEW_CONNECTION, peer));
+
+    auto&& conn = *conns_.emplace(sock, std::make_unique<Connection>(sock, peer, users_, history_, journal_, rooms_, logger_)).first->second;
+    arm_recv(conn);
+}
+
+auto Proactor::on_wakeup(int res) -> void
+{
+    std::vector<int> notified;
+
+    {
+        std::lock_guard lock(mutex_);
+        notified.swap(notified_);
+    }
+
+    ready_.insert(notified.begin(), notified.end());
+
+    if (res != -ECANCELED) { arm_wakeup(); }
+}
+
+auto Proactor::on_recv(Connection& conn, int res, uint32_t flags) -> void
+{
+    if (!(flags & IORING_CQE_F_MORE)) { conn.receiving = false; }
+
+    // received bytes are copied out, the buffer is returned immediately
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+        auto bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        conn.session.get_recv_buffer().append(ring_->buffer(bid), res);
+        ring_->recycle(bid);
+
+        if (!conn.closing) { dispatch(conn); }
+    }
+
+    // older kernels reject multishot recv, single-shot is used instead
+    else if (res == -EINVAL && multishot_recv_) { multishot_recv_ = false; }
+
+    // out of buffers or cancelled by backpressure
+    else if (res == -ENOBUFS || res == -ECANCELED) { }
+
+    else { conn.broken = true; }
+
+    if (!conn.receiving && conn.reading && !conn.broken && !conn.closing && !conn.session.done()) { arm_recv(conn); }
+
+    flush(conn);
+}
+
+auto Proactor::on_send(Connection& conn, int res) -> void
+{
+    auto&& queue = conn.session.get_send_queue();
+
+    conn.sending = false;
+
+    if (res >= 0) { queue.advance(res); }
+    else if (res != -EAGAIN && res != -EINTR) { conn.broken = true; }
+
+    if (conn.broken || conn.closing) { return; }
+
+    // reading resumes once the queue is short enough
+    if (!conn.reading && !conn.session.done() && queue.depth() <= SendQueue::MAX_DEPTH / 2) {
+        conn.reading = true;
+        dispatch(conn);
+
+        if (conn.reading && !conn.receiving && !conn.broken) { arm_recv(conn); }
+    }
+
+    flush(conn);
+
+    // messages could have arrived while sending
+    if (!conn.sending && chats_.contains(conn.session.get_socket())) { ready_.insert(conn.session.get_socket()); }
+}
+
+auto Proactor::dispatch(Connection& conn) -> void
+{
+    if (!conn.reading) { return; }
+
+    switch (conn.session.dispatch()) {
+    case Dispatch::BACKPRESSURE:
+        conn.reading = false;
+        cancel_recv(conn);
+        break;
+    case Dispatch::BROKEN:
+        conn.broken = true;
+        break;
+    case Dispatch::TAKEN:
+    case Dispatch::CONTINUE:
+        break;
+    }
+}
+
+auto Proactor::flush(Connection& conn) -> void
+{
+    auto&& queue = conn.session.get_send_queue();
+
+    conn.session.stage_outbox();
+
+    if (conn.sending || conn.broken || conn.closing) { return; }
+
+    if (queue.empty()) {
+        conn.session.confirm_delivery();
+        return;
+    }
+
+    // headers and bodies of all queued packets go out by one submission
+    auto iov = queue.gather();
+    conn.msg = msghdr{};
+    conn.msg.msg_iov = iov.data();
+    conn.msg.msg_iovlen = iov.size();
+
+    auto sqe = ring_->get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn.session.get_socket();
+    sqe->addr = reinterpret_cast<uint64_t>(&conn.msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = conn.user_data(OP_SEND);
+
+    ++conn.ops;
+    conn.sending = true;
+}
+
+auto Proactor::update(Connection& conn) -> void
+{
+    auto sock = conn.session.get_socket();
+
+    // in-flight operations are completed by shutdown
+    if (!conn.closing && (conn.broken || (conn.session.done() && !conn.sending))) {
+        conn.closing = true;
+        shutdown(sock, SHUT_RDWR);
+
+        if (conn.subscribed != nullptr) {
+            conn.subscribed->subscribe(nullptr);
+            conn.subscribed = nullptr;
+            chats_.erase(sock);
+        }
+    }
+
+    if (conn.closing) {
+        if (conn.ops > 0) { return; }
+
+        conn.session.finish();
+        logger_.log(LogRecord(LogFormat::CLOSE_CONNECTION, conn.peer));
+        conns_.erase(sock); // session closes the socket
+        return;
+    }
+
+    auto target = (conn.session.mode() == ClientMode::CHAT)
+        ? (&conn.session.get_incoming())
+        : (nullptr);
+
+    if (target == conn.subscribed) { return; }
+
+    if (conn.subscribed != nullptr) {
+        conn.subscribed->subscribe(nullptr);
+        chats_.erase(sock);
+    }
+
+    // pushes to opponent's pending messages wake up the Proactor
+    if (target != nullptr) {
+        target->subscribe([this, sock]() { notify(sock); });
+        chats_.insert(sock);
+        ready_.insert(sock);
+    }
+
+    conn.subscribed = target;
+}
+
+auto Proactor::on_ready() -> void
+{
+    std::unordered_set<int> ready;
+    ready.swap(ready_);
+
+    for (auto sock : ready) {
+        if (!chats_.contains(sock)) { continue; }
+
+        auto&& conn = *conns_.at(sock);
+
+        // do not fetch more until previous messages are sent, the next
+        // round is triggered by the send completion
+        if (!conn.session.done() && !conn.broken && !conn.sending) {
+            conn.session.fetch_pending();
+            flush(conn);
+        }
+        update(conn);
+    }
+}
+
+auto Proactor::loop(const std::atomic_bool& done) -> void
+{
+    // ring is bound to the thread that submits
+    Uring ring(RING_ENTRIES, BUFFER_COUNT, BUFFER_SIZE);
+    ring_ = &ring;
+
+    for (std::size_t i = 0; i < listeners_.size(); ++i) { arm_accept(i); }
+    arm_wakeup();
+
+    auto reap = [&]() {
+        for (auto cqe = ring.peek_cqe(); cqe != nullptr; cqe = ring.peek_cqe()) {
+            auto user_data = cqe->user_data;
+            auto res = cqe->res;
+            auto flags = cqe->flags;
+            ring.seen();
+
+            auto op = user_data & OP_MASK;
+            auto conn = reinterpret_cast<Connection*>(user_data & ~static_cast<uint64_t>(OP_MASK));
+
+            switch (op) {
+                case OP_ACCEPT: on_accept(user_data >> 3, res, flags); continue;
+                case OP_WAKEUP: on_wakeup(res); continue;
+                case OP_RECV: if (!(flags & IORING_CQE_F_MORE)) { --conn->ops; } on_recv(*conn, res, flags); break;
+                case OP_SEND: --conn->ops; on_send(*conn, res); break;
+                default: --conn->ops; break;
+            }
+
+            update(*conn);
+        }
+    };
+
+    while (!done.load()) {
+        on_ready();
+
+        // sessions with more pending messages do not wait for completions
+        ring.submit_and_wait(ready_.empty() ? 1 : 0);
+        reap();
+    }
+
+    // remaining connections are shut down and released after their last
+    // completion, the ring outlives every operation referencing them
+    stopping_ = true;
+
+    std::vector<Connection*> conns;
+    for (auto&& [sock, conn] : conns_) { conns.push_back(conn.get()); }
+    for (auto conn : conns) { conn->broken = true; update(*conn); }
+
+    while (!conns_.empty()) {
+        ring.submit_and_wait(1);
+        reap();
+    }
+
+    ring_ = nullptr;
+}
+
+Proactor::~Proactor()
+{
+    close(wakeup_);
+}
@@ -0,0 +1,131 @@
+#ifndef SERVER_PROACTOR_HPP_
+#define SERVER_PROACTOR_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares io_uring-based event loop Proactor used by
+ * Server in uring mode.
+**/
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "history.hpp"
+#include "log_record.hpp"
+#include "pending_journal.hpp"
+#include "room.hpp"
+#include "storage.hpp"
+
+class Uring;
+
+
+/**
+ * @brief Completion-based counterpart of Reactor. Each Proactor owns one
+ *     io_uring, accepts connections on its listening sockets (possibly
+ *     shared with other Proactors) by multishot accept, receives into
+ *     provided buffers by multishot recv and sends queued packets by one
+ *     gather @b sendmsg per flush.
+ *
+ * @note All methods except @b wake and @b notify run on the Proactor
+ *     thread exclusively.
+**/
+class Proactor final
+{
+private:
+    struct Connection;
+
+    std::vector<int> listeners_;
+    int wakeup_;
+    uint64_t wakeup_value_;
+    Uring* ring_;
+    bool multishot_recv_;
+    bool stopping_;
+    UserMap& users_;
+    History& history_;
+    PendingJournal& journal_;
+    Rooms& rooms_;
+    ServerLogger& logger_;
+
+    std::mutex mutex_;
+    std::vector<int> notified_;
+
+    std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+    std::unordered_set<int> chats_;
+    std::unordered_set<int> ready_;
+
+    void arm_accept(std::size_t idx);
+    void arm_wakeup();
+    void arm_recv(Connection& conn);
+    void cancel_recv(Connection& conn);
+
+    void on_accept(std::size_t idx, int res, uint32_t flags);
+    void on_wakeup(int res);
+    void on_recv(Connection& conn, int res, uint32_t flags);
+    void on_send(Connection& conn, int res);
+
+    /**
+     * @brief Handles buffered packets, receiving stops while the send
+     *     queue is too deep (backpressure).
+    **/
+    void dispatch(Connection& conn);
+
+    /**
+     * @brief Moves opponent's pending messages of ready chatting sessions
+     *     to their outboxes.
+    **/
+    void on_ready();
+
+    /**
+     * @brief Stages outbox and submits one gather send unless another one
+     *     is in flight.
+    **/
+    void flush(Connection& conn);
+
+    /**
+     * @brief Reflects session state in Proactor structures. Finished
+     *     sessions are shut down and released once their last operation
+     *     completes.
+     *
+     * @note Shall be the last use of @b conn by the caller.
+    **/
+    void update(Connection& conn);
+
+    /**
+     * @brief Thread-safe notification about new pending messages for the
+     *     session on @b sock, invoked by producers.
+    **/
+    void notify(int sock);
+
+public:
+
+    /**
+     * @param listeners listening sockets served by this Proactor.
+    **/
+    Proactor(std::vector<int> listeners, UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger);
+
+    /**
+     * @brief Thread-safe wake up of the event loop.
+    **/
+    void wake();
+
+    /**
+     * @brief Event loop, runs until @b done is set and Proactor is woken up.
+     *     The ring is created by the calling thread, throws
+     *     @b std::runtime_error if it cannot be set up.
+    **/
+    void loop(const std::atomic_bool& done);
+
+    Proactor(Proactor&&) = delete;
+    Proactor(const Proactor&) = delete;
+    Proactor& operator=(Proactor&&) = delete;
+    Proactor& operator=(const Proactor&) = delete;
+    ~Proactor();
+};
+
+
+#endif
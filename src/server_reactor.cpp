@@ -0,0 +1,364 @@
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "message.hpp"
+#include "server_reactor.hpp"
+#include "server_session.hpp"
+
+
+constexpr int MAX_EVENTS = 64; // events retrieved by one epoll_wait
+
+
+struct Reactor::Connection
+{
+    ServerSession session;
+    uint64_t peer;
+    PendingDeque* subscribed;
+    uint32_t events;
+    bool reading;
+    bool writing;
+    bool broken;
+    bool moved;
+
+    Connection(int sock, uint64_t peer, UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger, ShardRouter* router, std::size_t shard)
+        : session(sock, users, history, journal, rooms, logger, router, shard), peer(peer), subscribed(nullptr), events(EPOLLIN), reading(true), writing(false), broken(false), moved(false)
+    {
+    }
+};
+
+
+Reactor::Reactor(UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger, ShardRouter* router, std::size_t shard)
+    : epoll_(-1), wakeup_(-1), users_(users), history_(history), journal_(journal), rooms_(rooms), logger_(logger), router_(router), shard_(shard), mutex_(), adopted_(), notified_(), conns_(), chats_(), ready_()
+{
+    if ((epoll_ = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        throw std::runtime_error("Reactor cannot create epoll instance.");
+    }
+
+    if ((wakeup_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        close(epoll_);
+        throw std::runtime_error("Reactor cannot create wake up descriptor.");
+    }
+
+    epoll_event ev { .events = EPOLLIN, .data = { .fd = wakeup_ } };
+    if (epoll_ctl(epoll_, EPOLL_CTL_ADD, wakeup_, &ev) == -1) {
+        close(wakeup_);
+        close(epoll_);
+        throw std::runtime_error("Reactor cannot watch wake up descriptor.");
+    }
+}
+
+auto Reactor::adopt(int sock, uint64_t peer) -> void
+{
+    {
+        std::lock_guard lock(mutex_);
+        adopted_.emplace_back(sock, peer);
+    }
+    wake();
+}
+
+auto Reactor::wake() -> void
+{
+    uint64_t one = 1;
+    [[maybe_unused]] auto res = write(wakeup_, &one, sizeof(one));
+}
+
+auto Reactor::notify(int sock) -> void
+{
+    bool first;
+
+    {
+        std::lock_guard lock(mutex_);
+        first = notified_.empty();
+        notified_.push_back(sock);
+    }
+
+    // avoid excessive system calls upon bursts
+    if (first) { wake(); }
+}
+
+auto Reactor::on_wakeup() -> void
+{
+    std::vector<std::pair<int, uint64_t>> adopted;
+    std::vector<int> notified;
+
+    uint64_t cnt;
+    [[maybe_unused]] auto res = read(wakeup_, &cnt, sizeof(cnt));
+
+    // messages from other shards notify their chats before the swap
+    if (router_ != nullptr) {
+        router_->receive(shard_, [this](ShardEvent&& event) { on_shard_event(std::move(event)); });
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        adopted.swap(adopted_);
+        notified.swap(notified_);
+    }
+
+    ready_.insert(notified.begin(), notified.end());
+
+    for (auto&& [sock, peer] : adopted) {
+        epoll_event ev { .events = EPOLLIN, .data = { .fd = sock } };
+
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, sock, &ev) == -1) {
+            logger_.log(LogRecord(LogFormat::NOT_WATCHED, sock));
+            close(sock);
+            continue;
+        }
+
+        conns_.emplace(sock, std::make_unique<Connection>(sock, peer, users_, history_, journal_, rooms_, logger_, router_, shard_));
+    }
+}
+
+auto Reactor::on_shard_event(ShardEvent&& event) -> void
+{
+    switch (event.kind) {
+    case ShardEventKind::HAND_OVER:
+    {
+        auto sock = event.sock;
+        epoll_event ev { .events = EPOLLIN, .data = { .fd = sock } };
+
+        if (epoll_ctl(epoll_, EPOLL_CTL_ADD, sock, &ev) == -1) {
+            logger_.log(LogRecord(LogFormat::NOT_WATCHED, sock));
+            close(sock);
+            return;
+        }
+
+        auto&& conn = *conns_.emplace(sock, std::make_unique<Connection>(sock, event.peer, users_, history_, journal_, rooms_, logger_, router_, shard_)).first->second;
+
+        // continue as if the packets were received here
+        conn.session.handle(std::move(event.body));
+        conn.session.stage_outbox();
+        conn.session.get_recv_buffer().append(reinterpret_cast<const uint8_t*>(event.rest.data()), event.rest.size());
+
+        on_readable(conn);
+        if (!conn.broken) { flush(conn); }
+        update(conn);
+    }
+    break;
+    case ShardEventKind::MESSAGE:
+    {
+        auto id = journal_.enqueue(event.owner, event.opponent, event.body);
+        users_.observe(event.owner).get_pending().observe(event.opponent).push_back(PendingMessage{ .id = id, .body = std::make_shared<const Message>(std::move(event.body)) });
+    }
+    break;
+    case ShardEventKind::HISTORY:
+    {
+        history_.push_back({ event.owner, event.opponent }, event.msgs);
+    }
+    break;
+    }
+}
+
+auto Reactor::hand_over(Connection& conn, Message& msg) -> bool
+{
+    bool binary = false, acks = false;
+    auto shard = router_->shard_of(UserId(split_log_in(msg, binary, acks)));
+    if (shard == shard_) { return false; }
+
+    auto&& buffer = conn.session.get_recv_buffer();
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, conn.session.get_socket(), nullptr);
+    conn.session.release_socket();
+
+    router_->send(shard_, shard, ShardEvent{ .kind = ShardEventKind::HAND_OVER, .sock = conn.session.get_socket(), .peer = conn.peer, .body = std::move(msg), .rest = buffer.take() });
+    conn.moved = true;
+    return true;
+}
+
+auto Reactor::on_readable(Connection& conn) -> void
+{
+    auto sock = conn.session.get_socket();
+    auto&& buffer = conn.session.get_recv_buffer();
+
+    if (!conn.reading) { return; }
+
+    // the first packet decides the shard owning the connection
+    auto take = [&](Message& msg) {
+        return router_ != nullptr && conn.session.mode() == ClientMode::LOG_IN && hand_over(conn, msg);
+    };
+
+    // interpret buffered packets first, then drain the socket
+    for (;;) {
+        switch (conn.session.dispatch(take)) {
+        case Dispatch::BACKPRESSURE:
+            conn.reading = false;
+            watch(conn);
+            return;
+        case Dispatch::BROKEN:
+            conn.broken = true;
+            return;
+        case Dispatch::TAKEN:
+            return;
+        case Dispatch::CONTINUE:
+            break;
+        }
+
+        if (conn.session.done()) { break; }
+
+        auto cnt = buffer.fill(sock);
+        auto err = errno;
+
+        if (cnt > 0) { continue; }
+
+        conn.broken = (cnt == 0) || (cnt == -1 && err != EWOULDBLOCK && err != EAGAIN);
+        break;
+    }
+}
+
+auto Reactor::flush(Connection& conn) -> void
+{
+    auto sock = conn.session.get_socket();
+    auto&& queue = conn.session.get_send_queue();
+
+    for (;;) {
+        conn.session.stage_outbox();
+        if (!queue.write(sock)) { conn.broken = true; return; }
+
+        // reading resumes once the queue is short enough
+        if (conn.reading || conn.session.done() || queue.depth() > SendQueue::MAX_DEPTH / 2) { break; }
+
+        conn.reading = true;
+        on_readable(conn);
+        if (conn.broken || conn.moved) { return; }
+    }
+
+    auto drained = queue.empty();
+
+    if (drained) {
+        conn.session.confirm_delivery();
+
+        // messages could have arrived while writing
+        if (conn.writing && chats_.contains(sock)) { ready_.insert(sock); }
+    }
+
+    // watch writability only while something is left
+    conn.writing = !drained;
+    watch(conn);
+}
+
+auto Reactor::watch(Connection& conn) -> void
+{
+    uint32_t events = (conn.reading ? EPOLLIN : 0U) | (conn.writing ? EPOLLOUT : 0U);
+    if (events == conn.events) { return; }
+
+    conn.events = events;
+    epoll_event ev { .events = events, .data = { .fd = conn.session.get_socket() } };
+    epoll_ctl(epoll_, EPOLL_CTL_MOD, conn.session.get_socket(), &ev);
+}
+
+auto Reactor::update(Connection& conn) -> void
+{
+    auto sock = conn.session.get_socket();
+
+    // the socket belongs to another shard, nothing to finish
+    if (conn.moved) {
+        conns_.erase(sock);
+        return;
+    }
+
+    if (conn.broken || (conn.session.done() && !conn.writing)) {
+        release(sock);
+        return;
+    }
+
+    auto target = (conn.session.mode() == ClientMode::CHAT)
+        ? (&conn.session.get_incoming())
+        : (nullptr);
+
+    if (target == conn.subscribed) { return; }
+
+    if (conn.subscribed != nullptr) {
+        conn.subscribed->subscribe(nullptr);
+        chats_.erase(sock);
+    }
+
+    // pushes to opponent's pending messages wake up the Reactor
+    if (target != nullptr) {
+        target->subscribe([this, sock]() { notify(sock); });
+        chats_.insert(sock);
+        ready_.insert(sock);
+    }
+
+    conn.subscribed = target;
+}
+
+auto Reactor::on_ready() -> void
+{
+    std::unordered_set<int> ready;
+    ready.swap(ready_);
+
+    for (auto sock : ready) {
+        if (!chats_.contains(sock)) { continue; }
+
+        auto&& conn = *conns_.at(sock);
+
+        // do not fetch more until previous messages are sent
+        if (!conn.session.done() && !conn.broken && !conn.writing) {
+            conn.session.fetch_pending();
+            flush(conn);
+
+            // fetch is bounded, the rest goes out in the next round
+            if (!conn.writing && !conn.broken && !conn.session.get_incoming().empty()) { ready_.insert(sock); }
+        }
+        update(conn);
+    }
+}
+
+auto Reactor::release(int sock) -> void
+{
+    auto it = conns_.find(sock);
+    if (it == conns_.end()) { return; }
+
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, sock, nullptr);
+
+    if (it->second->subscribed != nullptr) {
+        it->second->subscribed->subscribe(nullptr);
+        chats_.erase(sock);
+    }
+
+    it->second->session.finish();
+    logger_.log(LogRecord(LogFormat::CLOSE_CONNECTION, it->second->peer));
+    conns_.erase(it); // session closes the socket
+}
+
+auto Reactor::loop(const std::atomic_bool& done) -> void
+{
+    epoll_event events[MAX_EVENTS];
+
+    while (!done.load()) {
+        // events for other shards are announced once per round
+        if (router_ != nullptr) { router_->flush(shard_); }
+
+        // sessions with more pending messages do not wait for events
+        auto cnt = epoll_wait(epoll_, events, MAX_EVENTS, ready_.empty() ? -1 : 0);
+
+        for (int i = 0; i < cnt; ++i) {
+            auto fd = events[i].data.fd;
+
+            if (fd == wakeup_) { on_wakeup(); continue; }
+
+            auto it = conns_.find(fd);
+            if (it == conns_.end()) { continue; }
+
+            auto&& conn = *it->second;
+
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) { on_readable(conn); }
+            if (!conn.broken && !conn.moved) { flush(conn); }
+
+            update(conn);
+        }
+
+        on_ready();
+    }
+
+    while (!conns_.empty()) { release(conns_.begin()->first); }
+}
+
+Reactor::~Reactor()
+{
+    for (auto&& [sock, peer] : adopted_) { close(sock); }
+
+    close(wakeup_);
+    close(epoll_);
+}
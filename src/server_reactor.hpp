@@ -0,0 +1,148 @@
+#ifndef SERVER_REACTOR_HPP_
+#define SERVER_REACTOR_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares epoll-based event loop Reactor used by Server
+ * in reactor mode.
+**/
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "history.hpp"
+#include "log_record.hpp"
+#include "pending_journal.hpp"
+#include "room.hpp"
+#include "server_shard.hpp"
+#include "storage.hpp"
+
+
+/**
+ * @brief Event loop owning a set of non-blocking sockets. Each socket is
+ *     served by a ServerSession driven by readiness events instead of
+ *     a dedicated thread.
+ *
+ * @note Sockets are passed from the accepting thread via thread-safe
+ *     @b adopt, all other methods run on the Reactor thread exclusively.
+ *     In shard mode, Reactor drives one shard of ShardRouter and hands
+ *     connections over to shards owning their users upon log in.
+**/
+class Reactor final
+{
+private:
+    struct Connection;
+
+    int epoll_;
+    int wakeup_;
+    UserMap& users_;
+    History& history_;
+    PendingJournal& journal_;
+    Rooms& rooms_;
+    ServerLogger& logger_;
+    ShardRouter* router_;
+    std::size_t shard_;
+
+    std::mutex mutex_;
+    std::vector<std::pair<int, uint64_t>> adopted_;
+    std::vector<int> notified_;
+
+    std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+    std::unordered_set<int> chats_;
+    std::unordered_set<int> ready_;
+
+    /**
+     * @brief Registers sockets passed from the accepting thread and marks
+     *     notified chats as ready.
+    **/
+    void on_wakeup();
+
+    /**
+     * @brief Handles event passed from another shard.
+    **/
+    void on_shard_event(ShardEvent&& event);
+
+    /**
+     * @brief Passes connection with log in packet @b msg to the shard
+     *     owning the user, returns false if the user is owned locally.
+    **/
+    bool hand_over(Connection& conn, Message& msg);
+
+    /**
+     * @brief Handles buffered packets and reads everything the kernel has,
+     *     reading stops while the send queue is too deep (backpressure).
+    **/
+    void on_readable(Connection& conn);
+
+    /**
+     * @brief Moves opponent's pending messages of ready chatting sessions
+     *     to their outboxes.
+    **/
+    void on_ready();
+
+    /**
+     * @brief Stages outbox and writes as much as the socket accepts.
+     *     Remaining bytes are written upon @b EPOLLOUT, reading is resumed
+     *     once the send queue is short enough.
+    **/
+    void flush(Connection& conn);
+
+    /**
+     * @brief Updates watched events according to the connection state.
+    **/
+    void watch(Connection& conn);
+
+    /**
+     * @brief Reflects session state (mode, done) in Reactor structures.
+     *     Chatting sessions are subscribed to their pending messages.
+    **/
+    void update(Connection& conn);
+
+    /**
+     * @brief Finishes session and closes the socket.
+    **/
+    void release(int sock);
+
+    /**
+     * @brief Thread-safe notification about new pending messages for the
+     *     session on @b sock, invoked by producers.
+    **/
+    void notify(int sock);
+
+public:
+    /**
+     * @param router connects shards (shard mode), @b users, @b history and
+     *     @b journal belong to @b shard then.
+    **/
+    Reactor(UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger, ShardRouter* router = nullptr, std::size_t shard = 0);
+
+    /**
+     * @brief Thread-safe hand over of a freshly accepted non-blocking socket,
+     *     @b peer is packed by @b make_log_peer .
+    **/
+    void adopt(int sock, uint64_t peer);
+
+    /**
+     * @brief Thread-safe wake up of the event loop.
+    **/
+    void wake();
+
+    /**
+     * @brief Event loop, runs until @b done is set and Reactor is woken up.
+    **/
+    void loop(const std::atomic_bool& done);
+
+    Reactor(Reactor&&) = delete;
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(Reactor&&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+    ~Reactor();
+};
+
+
+#endif
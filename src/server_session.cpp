@@ -1,13 +1,16 @@
-#include <sstream>
 #include <thread>
 #include "connect.hpp"
 #include "message.hpp"
+#include "server_coro.hpp"
 #include "server_session.hpp"
 #include "utility.hpp"
 
 
-ServerSession::ServerSession(int sock, UserMap& users, HistoryMap& history, Logger<std::string>& logger)
-    : Session(sock), users_(users), history_(history), logger_(logger)
+constexpr std::size_t FETCH_BUDGET = 1 << 20; // bytes fetched at once, the rest waits for the next round
+
+
+ServerSession::ServerSession(int sock, UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger, ShardRouter* router, std::size_t shard)
+    : Session(sock), users_(users), history_(history), journal_(journal), rooms_(rooms), logger_(logger), router_(router), shard_(shard), opponent_shard_(shard), owns_socket_(true), room_(false), user_(), opponent_(), user_name_(0), opponent_name_(0), binary_(false), acks_(false), incoming_(nullptr), outgoing_(nullptr), outbox_(), send_queue_(), inflight_mutex_(), inflight_(), inflight_ids_(), inflight_opponent_()
 {
 }
 
@@ -24,158 +27,479 @@ auto ServerSession::try_log_in(const UserId& user_name) -> bool
         && users_.observe(user_name).try_acquire(sock_);
 }
 
-auto ServerSession::serve() -> void
+auto ServerSession::handle_log_in(Message&& msg) -> void
+{
+    // protocol extensions are negotiated by tags, tags are echoed back
+    auto reply = msg;
+    msg.resize(split_log_in(msg, binary_, acks_).size());
+
+    auto succ = try_log_in(msg);
+    std::string suffix = (succ)
+        ? ("")
+        : (TERMINATION_SYMBOL);
+    post(std::move(reply) + suffix);
+
+    // user is acquired only upon success, otherwise session is over
+    if (succ) { user_name_ = LogNames::intern(msg); user_ = std::move(msg); }
+    done_.store(!succ);
+    mode_ = ClientMode::COMMAND;
+}
+
+auto ServerSession::handle_command(Message&& msg) -> void
+{
+    // unacknowledged messages of the last chat are pending again
+    requeue_inflight();
+
+    auto command = (binary_)
+        ? (decode_binary_command(msg))
+        : (decode_text_command(msg));
+
+    // response of a tagged command is packed into one packet
+    auto first = outbox_.size();
+
+    switch (command.command)
+    {
+    case Command::PEND:
+    {
+        // only opponents with unread messages are visited
+        for (auto&& [opponent, cnt] : users_.observe(*user_).get_pending().unread()) {
+            post(opponent + ' ' + std::to_string(cnt));
+        }
+        if (!command.tagged) { post(TERMINATION_SYMBOL); }
+    }
+    break;
+    case Command::QUIT:
+    {
+        done_.store(true);
+    }
+    break;
+    case Command::CHAT:
+    {
+        opponent_ = UserId(command.name);
+        opponent_name_ = LogNames::intern(opponent_);
+        room_ = is_room_name_valid(opponent_);
+        opponent_shard_ = (router_ != nullptr && !room_) ? router_->shard_of(opponent_) : shard_;
+        incoming_ = &users_.observe(*user_).get_pending().observe(opponent_);
+
+        // pending messages of a remote opponent are reachable only by its shard,
+        // room messages are fanned out by the room, the user joins it if needed
+        if (room_) { rooms_.join(opponent_, *user_, *incoming_); }
+        outgoing_ = (opponent_shard_ == shard_ && !room_)
+            ? (&users_.observe(opponent_).get_pending().observe(*user_))
+            : (nullptr);
+        if (command.last_id > 0) { skip_delivered(command.last_id); }
+        post(Message(opponent_));
+        mode_ = ClientMode::CHAT;
+        logger_.log(LogRecord(LogFormat::CHAT_STARTED, user_name_, opponent_name_));
+    }
+    break;
+    case Command::HIST:
+    {
+        auto hist = (is_room_name_valid(command.name))
+            ? (rooms_.get_last_n(UserId(command.name), command.count))
+            : (history_.get_last_n(get_ordered_pair(*user_, UserId(command.name)), command.count));
+        outbox_.insert(outbox_.end(), hist.begin(), hist.end());
+        if (!command.tagged) { post(TERMINATION_SYMBOL); }
+    }
+    break;
+    case Command::JOIN:
+    {
+        auto room = UserId(command.name);
+        rooms_.join(room, *user_, users_.observe(*user_).get_pending().observe(room));
+        post(std::move(room));
+    }
+    break;
+    case Command::LEAVE:
+    {
+        rooms_.leave(UserId(command.name), *user_);
+        post(Message(command.name));
+    }
+    break;
+    case Command::BAD:
+    case Command::HELP:
+    default:
+    {
+        logger_.log(LogRecord(LogFormat::BAD_COMMAND, sock_));
+        done_.store(true);
+    }
+    break;
+    }
+
+    if (command.tagged && !done_.load()) {
+        auto items = std::span(outbox_).subspan(first);
+        auto response = encode_tagged_response(command.request_id, items);
+        outbox_.resize(first);
+        post(std::move(response));
+    }
+}
+
+auto ServerSession::handle_chat(Message&& msg) -> void
 {
-    std::optional<UserId> maybe_user;
-    UserId chat_opponent;
+    if (msg == END_OF_CHAT_SYMBOL) {
+        mode_ = ClientMode::COMMAND;
+        logger_.log(LogRecord(LogFormat::CHAT_ENDED, user_name_, opponent_name_));
+    }
+
+    // cumulative acknowledgement is exactly <#> followed by digits, any
+    // other text (e.g. "<#>hi") is an ordinary message
+    else if (uint64_t id; acks_ && msg.starts_with(ACK_SYMBOL) && parse_message_id(std::string_view(msg).substr(std::size(ACK_SYMBOL) - 1), id)) {
+        std::lock_guard lock(inflight_mutex_);
+        deliver(id);
+    }
+
+    // members receive handles of the same message
+    else if (room_) {
+        rooms_.publish(opponent_, *user_, msg);
+    }
+
+    // opponent's shard journals and stores the message
+    else if (outgoing_ == nullptr) {
+        router_->send(shard_, opponent_shard_, ShardEvent{ .kind = ShardEventKind::MESSAGE, .owner = opponent_, .opponent = *user_, .body = std::move(msg) });
+    }
+
+    // store message for the opponent, journaled first (id is allocated)
+    else {
+        auto id = journal_.enqueue(opponent_, *user_, msg);
+        outgoing_->push_back(PendingMessage{ .id = id, .body = std::make_shared<const Message>(std::move(msg)) });
+    }
+}
+
+auto ServerSession::deliver(uint64_t last_id) -> void
+{
+    std::size_t cnt = 0;
+    while (cnt < inflight_ids_.size() && inflight_ids_[cnt] <= last_id) { ++cnt; }
+    if (cnt == 0) { return; }
+
+    // room messages are neither journaled nor recorded per member
+    if (!is_room_name_valid(inflight_opponent_)) {
+        journal_.dequeue(*user_, inflight_opponent_, inflight_ids_[cnt - 1]);
+
+        if (cnt == inflight_.size()) { record_history(inflight_opponent_, inflight_); }
+        else { record_history(inflight_opponent_, std::vector<MessageRef>(inflight_.begin(), inflight_.begin() + cnt)); }
+    }
+
+    inflight_.erase(inflight_.begin(), inflight_.begin() + cnt);
+    inflight_ids_.erase(inflight_ids_.begin(), inflight_ids_.begin() + cnt);
+}
+
+auto ServerSession::requeue_inflight() -> void
+{
+    std::lock_guard lock(inflight_mutex_);
+    if (inflight_.empty()) { return; }
+
+    auto&& pending = users_.observe(*user_).get_pending().observe(inflight_opponent_);
+    for (std::size_t i = inflight_.size(); i > 0; --i) {
+        pending.push_front(PendingMessage{ .id = inflight_ids_[i - 1], .body = inflight_[i - 1] });
+    }
+
+    inflight_.clear();
+    inflight_ids_.clear();
+}
+
+auto ServerSession::skip_delivered(uint64_t last_id) -> void
+{
+    std::vector<MessageRef> skipped;
+    uint64_t skipped_id = 0;
+
+    for (auto msg = incoming_->maybe_pop(); msg.has_value(); msg = incoming_->maybe_pop()) {
+        if (msg->id > last_id) { incoming_->push_front(std::move(*msg)); break; }
+
+        skipped_id = msg->id;
+        skipped.emplace_back(std::move(msg->body));
+    }
+
+    if (!skipped.empty() && !room_) {
+        journal_.dequeue(*user_, opponent_, skipped_id);
+        record_history(opponent_, skipped);
+    }
+}
+
+auto ServerSession::record_history(const UserId& opponent, const std::vector<MessageRef>& msgs) -> void
+{
+    auto pair = get_ordered_pair(*user_, opponent);
+    history_.push_back(pair, msgs);
+
+    // both shards keep the conversation, HIST is served locally
+    if (router_ == nullptr) { return; }
+
+    auto shard = router_->shard_of(opponent);
+    if (shard != shard_) {
+        router_->send(shard_, shard, ShardEvent{ .kind = ShardEventKind::HISTORY, .owner = pair.first, .opponent = pair.second, .msgs = msgs });
+    }
+}
+
+auto ServerSession::post(Message&& msg) -> void
+{
+    outbox_.emplace_back(std::make_shared<const Message>(std::move(msg)));
+}
+
+auto ServerSession::handle(Message&& msg) -> void
+{
+    switch (mode_)
+    {
+    case ClientMode::LOG_IN:
+        handle_log_in(std::move(msg));
+        break;
+    case ClientMode::COMMAND:
+        handle_command(std::move(msg));
+        break;
+    case ClientMode::CHAT:
+        handle_chat(std::move(msg));
+        break;
+    default:
+    {
+        logger_.log(LogRecord(LogFormat::BAD_MODE, sock_));
+        done_.store(true);
+    }
+    break;
+    }
+}
+
+auto ServerSession::fetch_pending() -> void
+{
+    std::lock_guard lock(inflight_mutex_);
+
+    // in-flight messages shall belong to exactly one chat
+    if (inflight_.empty()) { inflight_opponent_ = opponent_; }
+    else if (inflight_opponent_ != opponent_) { return; }
+
+    std::size_t fetched = 0;
+
+    // messages are sent as id:body if acknowledged, the history keeps bodies
+    for (auto msg = incoming_->maybe_pop(); msg.has_value(); msg = (fetched < FETCH_BUDGET) ? incoming_->maybe_pop() : std::nullopt) {
+        fetched += msg->body->size();
+        if (acks_ && msg->frame == nullptr) { msg->frame = std::make_shared<const Message>(encode_chat_frame(msg->id, *msg->body)); }
+        outbox_.emplace_back((acks_) ? (std::move(msg->frame)) : (msg->body));
+        inflight_.push_back(std::move(msg->body));
+        inflight_ids_.push_back(msg->id);
+    }
+}
+
+auto ServerSession::stage_outbox() -> void
+{
+    for (auto&& msg : outbox_) { send_queue_.push(std::move(msg)); }
+    outbox_.clear();
+}
+
+auto ServerSession::confirm_delivery() -> void
+{
+    // acknowledged messages are delivered upon acknowledgement
+    if (acks_) { return; }
+
+    std::lock_guard lock(inflight_mutex_);
+    if (!inflight_ids_.empty()) { deliver(inflight_ids_.back()); }
+}
+
+auto ServerSession::finish() -> void
+{
+    // undelivered messages are returned in the original order
+    requeue_inflight();
+
+    if (user_.has_value()) { users_.observe(*user_).release(sock_); }
 
+    if (recv_buffer_.oversized() > 0) {
+        logger_.log(LogRecord(LogFormat::PACKET_TOO_LARGE, recv_buffer_.oversized(), sock_));
+    }
+
+    logger_.log(LogRecord(LogFormat::SESSION_DONE, sock_, mode_));
+}
+
+auto ServerSession::flush_outbox() -> void
+{
+    // outbox is sent even if the session is done (e.g. rejected log in)
+    WakeupFlag cancel(false);
+    stage_outbox();
+    auto succ = send_queue_.drain(sock_, cancel);
+
+    if (succ) { confirm_delivery(); }
+    else { done_.store(true); }
+}
+
+auto ServerSession::get_send_queue() -> SendQueue&
+{
+    return send_queue_;
+}
+
+auto ServerSession::get_recv_buffer() -> RecvBuffer&
+{
+    return recv_buffer_;
+}
+
+auto ServerSession::get_incoming() -> PendingDeque&
+{
+    return *incoming_;
+}
+
+auto ServerSession::get_socket() const -> int
+{
+    return sock_;
+}
+
+auto ServerSession::mode() const -> ClientMode
+{
+    return mode_;
+}
+
+auto ServerSession::done() const -> bool
+{
+    return done_.load();
+}
+
+auto ServerSession::serve() -> void
+{
     while (!done_.load()) {
         switch (mode_)
         {
         case ClientMode::LOG_IN:
-        {
-            maybe_user = recv_with_maybe_fail();
-
-            if (!done_.load()) {
-                auto succ = try_log_in(*maybe_user);
-                std::string suffix = (succ)
-                    ? ("")
-                    : (TERMINATION_SYMBOL);
-                send_with_maybe_fail(*maybe_user + suffix);
-                done_.store(!succ);
-            }
-            mode_ = ClientMode::COMMAND;
-        }
-        break;
         case ClientMode::COMMAND:
         {
-            auto maybe_command = recv_with_maybe_fail();
-
-            if (!done_.load()) {
-                auto c = parse_command(*maybe_command);
-                switch (c)
-                {
-                break;
-                case Command::PEND:
-                {
-                    auto&& pending = users_.observe(*maybe_user).get_pending();
-                    for (auto&& opponent : pending.keys()) {
-                        if (!pending.observe(opponent).empty()) {
-                            send_with_maybe_fail(opponent);
-                        }
-                    }
-                    send_with_maybe_fail(TERMINATION_SYMBOL);
-                }
-                break;
-                case Command::QUIT:
-                {
-                    done_.store(true);
-                }
-                break;
-                case Command::CHAT:
-                {
-                    chat_opponent = parse_chat_command(*maybe_command);
-                    send_with_maybe_fail(chat_opponent);
-                    mode_ = ClientMode::CHAT;
-                }
-                break;
-                case Command::HIST:
-                {
-                    auto [n, opponent] = parse_hist_command(*maybe_command);
-                    auto hist = history_.observe(get_ordered_pair(*maybe_user, opponent)).get_last_n(n);
-                    for (const auto& h : hist) { send_with_maybe_fail(h); }
-                    send_with_maybe_fail(TERMINATION_SYMBOL);
-                }
-                break;
-                case Command::BAD:
-                case Command::HELP:
-                default:
-                {
-                    logger_.log(
-                        (std::ostringstream()
-                            << "Bad Command received on socket "
-                            << sock_
-                            << ", internal Session error."
-                        ).str()
-                    );
-                    done_.store(true);
-                }
-                break;
-                }
+            auto msg = recv_with_maybe_fail();
+            if (!done_.load()) { handle(std::move(*msg)); }
+
+            // pipelined commands received so far are answered by one flush,
+            // long responses go out before the end of the turn
+            while (!done_.load() && mode_ != ClientMode::CHAT && (msg = recv_buffer_.maybe_decode()).has_value()) {
+                if (msg->empty()) { done_.store(true); }
+                else { handle(std::move(*msg)); }
+
+                stage_outbox();
+                if (send_queue_.depth() >= SendQueue::FLUSH_THRESHOLD) { flush_outbox(); }
             }
+
+            flush_outbox();
         }
         break;
         case ClientMode::CHAT:
         {
-            constexpr int64_t CHAT_RATE = 50;
-            logger_.log("Chat " + *maybe_user + " -> " + chat_opponent + " started.");
-
-            // receive pendings for the opponent
-            std::atomic_bool recv_done(false);
+            // receive messages for the opponent until end of chat
+            WakeupFlag recv_done(false);
             std::thread t([&]() {
-                auto&& pendings = users_.observe(chat_opponent).get_pending().observe(*maybe_user);
-
                 while (!done_.load() && !recv_done.load()) {
-                    auto msg = RecvConnect(sock_, recv_done).recv_maybe_message();
-                    recv_done.store(!msg.has_value() || (msg.has_value() && (*msg == END_OF_CHAT_SYMBOL)));
+                    auto msg = RecvConnect(sock_, recv_buffer_, recv_done).recv_maybe_message();
+                    if (msg.has_value()) { handle(std::move(*msg)); }
 
-                    if (!recv_done.load()) {
-                        pendings.push_back(std::move(*msg));
-                        std::this_thread::sleep_for(std::chrono::milliseconds(CHAT_RATE));
-                    }
-                }
-            });
+                    // broken connection terminates the whole session
+                    else { done_.store(true); }
 
-            // send opponent's pendings
-            auto&& pending = users_.observe(*maybe_user).get_pending().observe(chat_opponent);
-            auto&& history = history_.observe(get_ordered_pair(*maybe_user, chat_opponent));
-            while (!done_.load() && !recv_done.load()) {
-                auto msg = pending.maybe_pop();
-                if (msg.has_value()) {
-                    send_with_maybe_fail(*msg);
-                    if (!done_.load()) { history.push_back(std::move(*msg)); }
+                    recv_done.store(!msg.has_value() || (mode_ != ClientMode::CHAT));
                 }
 
-                if (done_.load()) { pending.push_front(std::move(*msg)); }
+                // wake up the sender
+                incoming_->notify();
+            });
 
-                std::this_thread::sleep_for(std::chrono::milliseconds(CHAT_RATE));
+            // send opponent's pendings as soon as they appear
+            while (!done_.load() && !recv_done.load()) {
+                fetch_pending();
+                flush_outbox();
+                incoming_->wait(recv_done);
             }
 
             recv_done.store(true);
             if (t.joinable()) { t.join(); }
-            mode_ = ClientMode::COMMAND;
-            logger_.log("Chat " + *maybe_user + " -> " + chat_opponent + " ended.");
         }
         break;
         default:
         {
-            logger_.log(
-                (std::ostringstream()
-                    << "Bad ClientMode on socket "
-                    << sock_
-                    << ", internal Session error."
-                ).str()
-            );
-            done_.store(true);
+            handle(Message());
         }
         break;
         }
     }
 
-    if (maybe_user.has_value()) { users_.observe(*maybe_user).release(sock_); }
+    finish();
+}
+
+auto ServerSession::send_async(CoroLoop& loop) -> Task
+{
+    for (stage_outbox(); !send_queue_.empty(); stage_outbox()) {
+        if (!send_queue_.write(sock_)) { done_.store(true); co_return; }
+        if (!send_queue_.empty()) { co_await loop.writable(sock_); }
+    }
+
+    confirm_delivery();
+}
+
+auto ServerSession::recv_async(CoroLoop& loop) -> Task
+{
+    for (;;) {
+        auto cnt = recv_buffer_.fill(sock_);
+        auto err = errno;
+
+        if (cnt > 0) { co_return; }
+
+        if (cnt == 0 || (err != EWOULDBLOCK && err != EAGAIN)) {
+            done_.store(true);
+            co_return;
+        }
+
+        // opponent's messages interrupt waiting for the user
+        if (co_await loop.readable(sock_, mode_ == ClientMode::CHAT)) { co_return; }
+    }
+}
+
+auto ServerSession::dispatch(const std::function<bool(Message&)>& take) -> Dispatch
+{
+    for (auto msg = recv_buffer_.maybe_decode(); msg.has_value() && !done_.load(); msg = recv_buffer_.maybe_decode()) {
+
+        // empty body is not a valid packet
+        if (msg->empty()) { return Dispatch::BROKEN; }
+
+        if (take != nullptr && take(*msg)) { return Dispatch::TAKEN; }
 
-    logger_.log(
-        (std::ostringstream()
-            << "Socket "
-            << sock_
-            << " done in ClientMode "
-            << static_cast<int>(mode_)
-            << "."
-        ).str()
-    );
+        handle(std::move(*msg));
+        stage_outbox();
+
+        if (send_queue_.depth() > SendQueue::MAX_DEPTH) { return Dispatch::BACKPRESSURE; }
+    }
+
+    // oversized packet is never read
+    return (recv_buffer_.oversized() > 0) ? (Dispatch::BROKEN) : (Dispatch::CONTINUE);
+}
+
+auto ServerSession::serve_async(CoroLoop& loop) -> Task
+{
+    bool broken = false;
+
+    while (!done_.load()) {
+        auto result = dispatch();
+
+        // the rest is dispatched once responses go out
+        if (result == Dispatch::BACKPRESSURE) {
+            co_await send_async(loop);
+            continue;
+        }
+
+        broken = (result == Dispatch::BROKEN);
+        if (broken || done_.load()) { break; }
+
+        loop.subscribe(sock_, (mode_ == ClientMode::CHAT) ? incoming_ : nullptr);
+        if (mode_ == ClientMode::CHAT) { fetch_pending(); }
+
+        co_await send_async(loop);
+
+        // fetch is bounded, the rest goes out without waiting
+        if (mode_ == ClientMode::CHAT && !incoming_->empty()) { continue; }
+
+        if (!done_.load()) {
+            co_await recv_async(loop);
+            broken = done_.load();
+        }
+    }
+
+    // responses preceding quit go out
+    if (!broken) { co_await send_async(loop); }
+
+    loop.subscribe(sock_, nullptr);
+    finish();
+}
+
+auto ServerSession::release_socket() -> void
+{
+    owns_socket_ = false;
 }
 
 ServerSession::~ServerSession()
 {
-    close(sock_);
+    if (owns_socket_) { close(sock_); }
 }
@@ -7,30 +7,136 @@
  *
  * This header file declares object ServerSession.
 **/
-
-
-#include "logger.hpp"
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "coro.hpp"
+#include "history.hpp"
+#include "log_record.hpp"
+#include "pending_journal.hpp"
+#include "room.hpp"
+#include "server_shard.hpp"
 #include "session.hpp"
 #include "storage.hpp"
 
+class CoroLoop;
+
+
+/**
+ * @brief Outcome of @b ServerSession::dispatch, drivers act on it only.
+**/
+enum class Dispatch
+{
+    CONTINUE,     // buffered packets are handled or the session is done
+    BACKPRESSURE, // peer does not read responses, the rest waits in the buffer
+    BROKEN,       // empty or oversized packet, the connection is dropped
+    TAKEN         // packet has been taken over by the driver
+};
+
 
 /**
  * @brief Server potentially accommodates more than one socket during
  *     its lifetime. Server instance releases socket allocated upon
  *     start, and ServerSession releases accepted sockets.
+ *
+ * @note The state machine is driven either by the blocking @b serve, by
+ *     the coroutine @b serve_async or from outside (Reactor) via
+ *     @b dispatch, @b fetch_pending, @b confirm_delivery and @b finish. Responses are collected in the
+ *     outbox, staged to the send queue and written by the driver.
 **/
 class ServerSession final : public Session
 {
 private:
     UserMap& users_;
-    HistoryMap& history_;
-    Logger<std::string>& logger_;
+    History& history_;
+    PendingJournal& journal_;
+    Rooms& rooms_;
+    ServerLogger& logger_;
+    ShardRouter* router_;
+    std::size_t shard_;
+    std::size_t opponent_shard_;
+    bool owns_socket_;
+    bool room_;  // opponent is a room
+
+    std::optional<UserId> user_;
+    UserId opponent_;
+    LogName user_name_;
+    LogName opponent_name_;
+    bool binary_;
+    bool acks_;
+    PendingDeque* incoming_;
+    PendingDeque* outgoing_;
+    std::vector<MessageRef> outbox_;
+    SendQueue send_queue_;
+
+    std::mutex inflight_mutex_;
+    std::vector<MessageRef> inflight_;
+    std::vector<uint64_t> inflight_ids_;
+    UserId inflight_opponent_;
 
     UserPair get_ordered_pair(const UserId& u1, const UserId& u2);
     bool try_log_in(const UserId& user_name);
 
+    /**
+     * @brief In-flight messages up to @b last_id are delivered, they are
+     *     journaled and go to the history.
+     *
+     * @note Shall be called with locked @b inflight_mutex_.
+    **/
+    void deliver(uint64_t last_id);
+
+    /**
+     * @brief Returns in-flight messages back to pending in the original order.
+    **/
+    void requeue_inflight();
+
+    /**
+     * @brief Messages up to @b last_id were received by the client before
+     *     (resumed chat), they are delivered without sending.
+    **/
+    void skip_delivered(uint64_t last_id);
+
+    /**
+     * @brief Delivered messages go to the history, and to the history of
+     *     the opponent's shard if it is remote (shard mode).
+    **/
+    void record_history(const UserId& opponent, const std::vector<MessageRef>& msgs);
+
+    void handle_log_in(Message&& msg);
+    void handle_command(Message&& msg);
+    void handle_chat(Message&& msg);
+
+    /**
+     * @brief Appends a response to the outbox.
+    **/
+    void post(Message&& msg);
+
+    /**
+     * @brief Stages the outbox and drains the send queue (blocking),
+     *     delivery is confirmed upon success, otherwise the session is done.
+    **/
+    void flush_outbox();
+
+    /**
+     * @brief Stages the outbox and sends the send queue, suspends while
+     *     the socket is not writable. Delivery is confirmed upon success,
+     *     otherwise the session is done.
+    **/
+    Task send_async(CoroLoop& loop);
+
+    /**
+     * @brief Receives available bytes to the receive buffer, suspends
+     *     until there are some or, in CHAT mode, until opponent's pending
+     *     messages arrive. Broken connection makes the session done.
+    **/
+    Task recv_async(CoroLoop& loop);
+
 public:
-    ServerSession(int sock, UserMap& users, HistoryMap& history, Logger<std::string>& logger);
+    /**
+     * @param router passes messages to users of other shards (shard mode),
+     *     @b users, @b history and @b journal belong to @b shard then.
+    **/
+    ServerSession(int sock, UserMap& users, History& history, PendingJournal& journal, Rooms& rooms, ServerLogger& logger, ShardRouter* router = nullptr, std::size_t shard = 0);
 
     /**
      * @brief Server does not initiate
@@ -38,7 +144,70 @@ public:
     void serve() override;
 
     /**
-     * @brief ServerSession destructor @b shall close the socket!
+     * @brief Coroutine counterpart of @b serve, one coroutine serves both
+     *     directions of the chat. Finishes the session upon completion.
+    **/
+    Task serve_async(CoroLoop& loop);
+
+    /**
+     * @brief Interprets one received packet according to the current
+     *     ClientMode, responses are appended to the outbox.
+    **/
+    void handle(Message&& msg);
+
+    /**
+     * @brief Handles packets decoded from the receive buffer and stages
+     *     responses, stops once the send queue is too long. A packet is
+     *     offered to @b take first (if any), taken one stops dispatching.
+    **/
+    Dispatch dispatch(const std::function<bool(Message&)>& take = nullptr);
+
+    /**
+     * @brief Moves opponent's pending messages to the outbox (CHAT only),
+     *     up to a byte budget per call. Messages are considered in-flight
+     *     until delivery is confirmed, or acknowledged if acknowledgements
+     *     are negotiated.
+    **/
+    void fetch_pending();
+
+    /**
+     * @brief Moves responses from the outbox to the send queue.
+    **/
+    void stage_outbox();
+
+    /**
+     * @brief Send queue has been drained, in-flight messages go to the
+     *     history unless they wait for acknowledgement.
+    **/
+    void confirm_delivery();
+
+    /**
+     * @brief Returns in-flight messages back to pending, releases user.
+     *     Shall be called exactly once at the end of the session.
+    **/
+    void finish();
+
+    SendQueue& get_send_queue();
+    RecvBuffer& get_recv_buffer();
+
+    /**
+     * @brief Opponent's pending messages for the user (CHAT only).
+    **/
+    PendingDeque& get_incoming();
+
+    int get_socket() const;
+    ClientMode mode() const;
+    bool done() const;
+
+    /**
+     * @brief The socket is handed over to another owner, the destructor
+     *     does not close it.
+    **/
+    void release_socket();
+
+    /**
+     * @brief ServerSession destructor @b shall close the socket unless
+     *     it has been released!
     **/
     ~ServerSession();
 };
@@ -0,0 +1,83 @@
+#include <unistd.h>
+#include "server_shard.hpp"
+
+
+ShardRouter::ShardRouter(std::size_t count)
+    : shards_(), queues_()
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        auto&& shard = shards_.emplace_back(std::make_unique<Shard>());
+        shard->dirty.assign(count, 0);
+    }
+
+    for (std::size_t i = 0; i < count * count; ++i) {
+        queues_.emplace_back(std::make_unique<EventQueue>());
+    }
+}
+
+auto ShardRouter::queue(std::size_t from, std::size_t to) -> EventQueue&
+{
+    return *queues_[from * shards_.size() + to];
+}
+
+auto ShardRouter::count() const -> std::size_t
+{
+    return shards_.size();
+}
+
+auto ShardRouter::shard_of(const UserId& user) const -> std::size_t
+{
+    // high bits of the mixed hash, independent of map shards selected by low bits
+    auto h = static_cast<uint64_t>(StorageHash<UserId>()(user)) * 0x9e3779b97f4a7c15ULL;
+    return (h >> 32) % shards_.size();
+}
+
+auto ShardRouter::users(std::size_t shard) -> UserMap&
+{
+    return shards_[shard]->users;
+}
+
+auto ShardRouter::history(std::size_t shard) -> History&
+{
+    return shards_[shard]->history;
+}
+
+auto ShardRouter::journal(std::size_t shard) -> PendingJournal&
+{
+    return shards_[shard]->journal;
+}
+
+auto ShardRouter::set_wake(std::size_t shard, std::function<void()>&& wake) -> void
+{
+    shards_[shard]->wake = std::move(wake);
+}
+
+auto ShardRouter::send(std::size_t from, std::size_t to, ShardEvent&& event) -> void
+{
+    queue(from, to).push_back(std::move(event));
+    shards_[from]->dirty[to] = 1;
+}
+
+auto ShardRouter::flush(std::size_t from) -> void
+{
+    auto&& dirty = shards_[from]->dirty;
+
+    for (std::size_t to = 0; to < dirty.size(); ++to) {
+        if (dirty[to]) {
+            dirty[to] = 0;
+            shards_[to]->wake();
+        }
+    }
+}
+
+ShardRouter::~ShardRouter()
+{
+    // sockets handed over to stopped shards are closed, messages are
+    // journaled so that they survive the restart
+    for (std::size_t to = 0; to < shards_.size(); ++to) {
+        receive(to, [&](ShardEvent&& event) {
+            if (event.kind == ShardEventKind::HAND_OVER) { close(event.sock); }
+            if (event.kind == ShardEventKind::MESSAGE) { journal(to).enqueue(event.owner, event.opponent, event.body); }
+        });
+    }
+}
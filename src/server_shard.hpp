@@ -0,0 +1,130 @@
+#ifndef SERVER_SHARD_HPP_
+#define SERVER_SHARD_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares ShardRouter connecting event loops of Server
+ * in shard mode.
+**/
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "history.hpp"
+#include "pending_journal.hpp"
+#include "storage.hpp"
+
+
+enum class ShardEventKind
+{
+    HAND_OVER, // accepted socket, its log in packet and the rest of received bytes
+    MESSAGE,   // chat message for owner from opponent
+    HISTORY    // delivered messages of the conversation (owner, opponent)
+};
+
+
+/**
+ * @brief Event passed from one shard to another.
+**/
+struct ShardEvent
+{
+    ShardEventKind kind = ShardEventKind::MESSAGE;
+    int sock = -1;
+    uint64_t peer = 0;
+    UserId owner = {};
+    UserId opponent = {};
+    Message body = {};
+    Message rest = {};
+    std::vector<MessageRef> msgs = {};
+};
+
+
+/**
+ * @brief Shared-nothing partitioning of users among a fixed number of
+ *     shards (event loops). Each shard owns users selected by hash of
+ *     their names together with their pending queues, journal and history
+ *     of their conversations. Shards communicate only by events passed
+ *     over single-producer single-consumer queues, one per ordered pair
+ *     of shards.
+ *
+ * @note Shard @b i shall be driven by one thread, which is the only
+ *     producer of queues @b i -> @b * and the only consumer of queues
+ *     @b * -> @b i .
+**/
+class ShardRouter final
+{
+private:
+    struct Shard
+    {
+        UserMap users;
+        History history;
+        PendingJournal journal;
+        std::function<void()> wake;
+        std::vector<char> dirty; // shards to be woken up by this one
+    };
+
+    using EventQueue = SpscQueue<ShardEvent, 32>;
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<std::unique_ptr<EventQueue>> queues_;
+
+    EventQueue& queue(std::size_t from, std::size_t to);
+
+public:
+    ShardRouter(std::size_t count);
+
+    std::size_t count() const;
+
+    /**
+     * @brief Shard owning @b user .
+    **/
+    std::size_t shard_of(const UserId& user) const;
+
+    UserMap& users(std::size_t shard);
+    History& history(std::size_t shard);
+    PendingJournal& journal(std::size_t shard);
+
+    /**
+     * @brief Sets thread-safe wake up of the event loop driving @b shard ,
+     *     shall be called before any event is sent.
+    **/
+    void set_wake(std::size_t shard, std::function<void()>&& wake);
+
+    /**
+     * @brief Passes @b event from shard @b from to shard @b to , the
+     *     receiver is woken up by the next @b flush .
+    **/
+    void send(std::size_t from, std::size_t to, ShardEvent&& event);
+
+    /**
+     * @brief Wakes up shards that received events from @b from since the
+     *     last flush, once per shard.
+    **/
+    void flush(std::size_t from);
+
+    /**
+     * @brief Passes all events received by @b to to the @b handler .
+    **/
+    template <typename F>
+    void receive(std::size_t to, F&& handler);
+
+    ShardRouter(ShardRouter&&) = delete;
+    ShardRouter(const ShardRouter&) = delete;
+    ShardRouter& operator=(ShardRouter&&) = delete;
+    ShardRouter& operator=(const ShardRouter&) = delete;
+    ~ShardRouter();
+};
+
+template <typename F>
+inline auto ShardRouter::receive(std::size_t to, F&& handler) -> void
+{
+    for (std::size_t from = 0; from < shards_.size(); ++from) {
+        auto&& q = queue(from, to);
+        for (auto event = q.maybe_pop(); event.has_value(); event = q.maybe_pop()) { handler(std::move(*event)); }
+    }
+}
+
+
+#endif
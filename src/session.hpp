@@ -10,11 +10,17 @@
 #include <atomic>
 #include <optional>
 #include "connect.hpp"
+#include "flag.hpp"
 #include "storage.hpp"
 
 
 constexpr char TERMINATION_SYMBOL[] = "$";
 constexpr char END_OF_CHAT_SYMBOL[] = "<$>";
+constexpr char BINARY_PROTOCOL_TAG[] = "+bin"; // appended to the user name upon log in
+constexpr char ACK_PROTOCOL_TAG[] = "+ack";    // chat messages carry ids and are acknowledged
+constexpr char ACK_SYMBOL[] = "<#>";           // followed by the id of the last received message
+constexpr char CHUNK_SYMBOL[] = "<+>";         // chat message is continued by the next packet
+constexpr std::size_t MAX_CHUNK_SIZE = 64 << 10; // longer chat messages are sent in chunks
 
 
 /**
@@ -40,7 +46,8 @@ class Session
 protected:
     int sock_;
     ClientMode mode_;
-    std::atomic_bool done_;
+    WakeupFlag done_;
+    RecvBuffer recv_buffer_;
 
     Session(int sock);
 
@@ -69,7 +76,7 @@ public:
 };
 
 inline Session::Session(int sock)
-    : sock_(sock), mode_(ClientMode::LOG_IN), done_(false)
+    : sock_(sock), mode_(ClientMode::LOG_IN), done_(false), recv_buffer_()
 {
 }
 
@@ -80,7 +87,7 @@ inline auto Session::send_with_maybe_fail(const Message& msg) -> void
 
 inline auto Session::recv_with_maybe_fail() -> std::optional<Message>
 {
-    auto maybe_result = RecvConnect(sock_, done_).recv_maybe_message();
+    auto maybe_result = RecvConnect(sock_, recv_buffer_, done_).recv_maybe_message();
     done_.store(!maybe_result.has_value());
     return maybe_result;
 }
@@ -1,6 +1,53 @@
+#include <algorithm>
 #include "storage.hpp"
 
 
+PendingMap::PendingMap()
+    : unread_mutex_(), unread_(), mutex_(), storage_()
+{
+}
+
+auto PendingMap::track(const UserId& opponent, const PendingDeque& pending) -> void
+{
+    // transitions may race, the last one to lock observes the latest size
+    std::lock_guard lock(unread_mutex_);
+
+    if (pending.size() > 0) { unread_.try_emplace(opponent, &pending); }
+    else { unread_.erase(opponent); }
+}
+
+auto PendingMap::observe(const UserId& opponent) -> PendingDeque&
+{
+    std::lock_guard lock(mutex_);
+
+    auto [it, inserted] = storage_.try_emplace(opponent);
+    if (inserted) {
+        auto&& [key, pending] = *it;
+        pending.track([this, &key, &pending]() { track(key, pending); });
+    }
+
+    return it->second;
+}
+
+auto PendingMap::unread() -> std::vector<std::pair<UserId, std::size_t>>
+{
+    std::vector<std::pair<UserId, std::size_t>> result;
+
+    {
+        std::lock_guard lock(unread_mutex_);
+        result.reserve(unread_.size());
+
+        for (auto&& [opponent, pending] : unread_) {
+            auto cnt = pending->size();
+            if (cnt > 0) { result.emplace_back(opponent, cnt); }
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+
 User::User()
     : active_(0), pending_()
 {
@@ -7,12 +7,21 @@
  *
  * This header file contains an implementation of generic key-value storages.
 **/
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <deque>
-#include <map>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
+#include "flag.hpp"
 
 
 /**
@@ -70,58 +79,98 @@ inline auto ValueStorage<V>::store(const V& value) -> ValueStorage&
 
 
 /**
- * @brief Thread-safe vector-type storage for generic types.
+ * @brief Thread-safe bounded ring buffer of shared immutable items. The
+ *     oldest item is dropped once capacity is reached. Snapshots copy
+ *     pointers only, items are never copied.
+ *
+ * @note Capacity of newly constructed storages is configured globally
+ *     (e.g. upon start) via @b set_default_capacity.
 **/
 template <typename T>
-class VectorStorage final
+class RingStorage final
 {
 private:
+    static constexpr std::size_t DEFAULT_CAPACITY = 1000;
+    static inline std::atomic<std::size_t> default_capacity_ = DEFAULT_CAPACITY;
+
     std::mutex mutex_;
-    std::vector<T> vector_;
+    std::vector<std::shared_ptr<const T>> ring_;
+    std::size_t capacity_;
+    std::size_t head_;
 
 public:
-    VectorStorage();
+    RingStorage();
+
+    /**
+     * @brief Sets capacity of storages constructed afterwards.
+    **/
+    static void set_default_capacity(std::size_t capacity);
+
     void push_back(T&& item);
     void push_back(const T& item);
-    std::vector<T> get_last_n(std::size_t n);
+    void push_back(std::shared_ptr<const T> item);
 
-    VectorStorage(VectorStorage&&) = delete;
-    VectorStorage(const VectorStorage&) = delete;
-    VectorStorage& operator=(VectorStorage&&) = delete;
-    VectorStorage& operator=(const VectorStorage&) = delete;
+    /**
+     * @brief Snapshot of up to @b n latest items, the oldest first.
+    **/
+    std::vector<std::shared_ptr<const T>> get_last_n(std::size_t n);
+
+    RingStorage(RingStorage&&) = delete;
+    RingStorage(const RingStorage&) = delete;
+    RingStorage& operator=(RingStorage&&) = delete;
+    RingStorage& operator=(const RingStorage&) = delete;
 };
 
 template <typename T>
-inline VectorStorage<T>::VectorStorage()
-    : mutex_(), vector_()
+inline RingStorage<T>::RingStorage()
+    : mutex_(), ring_(), capacity_(default_capacity_.load()), head_(0)
 {
 }
 
 template <typename T>
-inline auto VectorStorage<T>::push_back(T&& item) -> void
+inline auto RingStorage<T>::set_default_capacity(std::size_t capacity) -> void
 {
-    std::lock_guard lock(mutex_);
-    vector_.push_back(std::move(item));
+    default_capacity_.store(std::max<std::size_t>(capacity, 1));
 }
 
 template <typename T>
-inline auto VectorStorage<T>::push_back(const T& item) -> void
+inline auto RingStorage<T>::push_back(T&& item) -> void
+{
+    push_back(std::make_shared<const T>(std::move(item)));
+}
+
+template <typename T>
+inline auto RingStorage<T>::push_back(const T& item) -> void
+{
+    push_back(std::make_shared<const T>(item));
+}
+
+template <typename T>
+inline auto RingStorage<T>::push_back(std::shared_ptr<const T> item) -> void
 {
     std::lock_guard lock(mutex_);
-    vector_.push_back(item);
+
+    // grow lazily, overwrite the oldest item once full
+    if (ring_.size() < capacity_) {
+        ring_.push_back(std::move(item));
+    } else {
+        ring_[head_] = std::move(item);
+        head_ = (head_ + 1) % capacity_;
+    }
 }
 
 template <typename T>
-inline auto VectorStorage<T>::get_last_n(std::size_t n) -> std::vector<T>
+inline auto RingStorage<T>::get_last_n(std::size_t n) -> std::vector<std::shared_ptr<const T>>
 {
-    std::vector<T> result;
+    std::vector<std::shared_ptr<const T>> result;
     std::lock_guard lock(mutex_);
 
-    auto size = static_cast<int>(vector_.size());
-    auto base = std::max(0, size - static_cast<int>(n));
+    auto size = ring_.size();
+    n = std::min(n, size);
+    result.reserve(n);
 
-    for (int i = base; i < size; ++i) {
-        result.push_back(vector_[i]);
+    for (auto i = size - n; i < size; ++i) {
+        result.push_back(ring_[(head_ + i) % size]);
     }
 
     return result;
@@ -129,15 +178,27 @@ inline auto VectorStorage<T>::get_last_n(std::size_t n) -> std::vector<T>
 
 
 /**
- * @brief Thread-safe deque-type storage for generic types.
+ * @brief Thread-safe deque-type storage for generic types. Consumers could
+ *     either block until an item arrives or subscribe a callback invoked
+ *     upon each push.
 **/
 template <typename T>
 class DequeStorage final
 {
 private:
     std::mutex mutex_;
+    std::condition_variable cond_;
+    std::size_t waiters_;
+    std::function<void()> callback_;
     std::deque<T> deque_;
 
+    /**
+     * @brief Wakes up waiters and invokes subscribed callback.
+     *
+     * @note Shall be called with locked mutex.
+    **/
+    void notify_locked();
+
 public:
     DequeStorage();
 
@@ -171,6 +232,32 @@ public:
     **/
     DequeStorage& push_front(const T& item);
 
+    /**
+     * @brief Blocks until storage is non-empty or @b cancel is set.
+     *
+     * @note Whoever sets @b cancel shall call @b notify afterwards.
+    **/
+    void wait(const WakeupFlag& cancel);
+
+    /**
+     * @brief Blocks until storage is non-empty, @b cancel is set or
+     *     @b timeout expires.
+    **/
+    template <typename Rep, typename Period>
+    void wait_for(const WakeupFlag& cancel, std::chrono::duration<Rep, Period> timeout);
+
+    /**
+     * @brief Thread-safe wake up of all waiters (e.g. upon cancellation).
+    **/
+    void notify();
+
+    /**
+     * @brief Thread-safe (un)subscription of a callback invoked upon each
+     *     push. Callback is invoked with locked storage, empty function
+     *     unsubscribes. No callback is invoked after unsubscription returns.
+    **/
+    void subscribe(std::function<void()>&& callback);
+
     DequeStorage(DequeStorage&&) = delete;
     DequeStorage(const DequeStorage&) = delete;
     DequeStorage& operator=(DequeStorage&&) = delete;
@@ -179,8 +266,15 @@ public:
 
 template <typename T>
 inline DequeStorage<T>::DequeStorage()
-    : mutex_(), deque_()
+    : mutex_(), cond_(), waiters_(0), callback_(), deque_()
+{
+}
+
+template <typename T>
+inline auto DequeStorage<T>::notify_locked() -> void
 {
+    if (waiters_ > 0) { cond_.notify_all(); }
+    if (callback_) { callback_(); }
 }
 
 template <typename T>
@@ -209,6 +303,7 @@ inline auto DequeStorage<T>::push_back(T&& item) -> DequeStorage<T>&
 {
     std::lock_guard lock(mutex_);
     deque_.push_back(std::move(item));
+    notify_locked();
     return *this;
 }
 
@@ -217,6 +312,7 @@ inline auto DequeStorage<T>::push_back(const T& item) -> DequeStorage<T>&
 {
     std::lock_guard lock(mutex_);
     deque_.push_back(item);
+    notify_locked();
     return *this;
 }
 
@@ -225,6 +321,7 @@ inline auto DequeStorage<T>::push_front(T&& item) -> DequeStorage<T>&
 {
     std::lock_guard lock(mutex_);
     deque_.push_front(std::move(item));
+    notify_locked();
     return *this;
 }
 
@@ -233,74 +330,671 @@ inline auto DequeStorage<T>::push_front(const T& item) -> DequeStorage<T>&
 {
     std::lock_guard lock(mutex_);
     deque_.push_front(item);
+    notify_locked();
     return *this;
 }
 
+template <typename T>
+inline auto DequeStorage<T>::wait(const WakeupFlag& cancel) -> void
+{
+    std::unique_lock lock(mutex_);
+    ++waiters_;
+    cond_.wait(lock, [&]() { return !deque_.empty() || cancel.load(); });
+    --waiters_;
+}
+
+template <typename T>
+template <typename Rep, typename Period>
+inline auto DequeStorage<T>::wait_for(const WakeupFlag& cancel, std::chrono::duration<Rep, Period> timeout) -> void
+{
+    std::unique_lock lock(mutex_);
+    ++waiters_;
+    cond_.wait_for(lock, timeout, [&]() { return !deque_.empty() || cancel.load(); });
+    --waiters_;
+}
+
+template <typename T>
+inline auto DequeStorage<T>::notify() -> void
+{
+    std::lock_guard lock(mutex_);
+    cond_.notify_all();
+}
+
+template <typename T>
+inline auto DequeStorage<T>::subscribe(std::function<void()>&& callback) -> void
+{
+    std::lock_guard lock(mutex_);
+    callback_ = std::move(callback);
+}
+
 
 /**
- * @brief Thread-safe key-value storage for generic types.
+ * @brief Lock-free multi-producer single-consumer queue storage for generic
+ *     types with the interface of DequeStorage. Producers link nodes by one
+ *     atomic exchange, the consumer never locks.
+ *
+ * @note @b maybe_pop, @b empty, @b push_front and @b wait shall be called
+ *     by the single consumer only. Requeued (@b push_front) items are kept
+ *     aside in a consumer-local deque and popped first.
 **/
-template <typename K, typename V>
-class MapStorage final
+template <typename T>
+class QueueStorage final
 {
 private:
+    struct Node
+    {
+        std::atomic<Node*> next;
+        std::optional<T> value;
+    };
+
+    std::atomic<Node*> head_;
+    Node* tail_;
+    Node stub_;
+    std::deque<T> front_;
+
     std::mutex mutex_;
-    std::map<K, V> storage_;
+    std::condition_variable cond_;
+    std::atomic<std::size_t> waiters_;
+    std::atomic_bool subscribed_;
+    std::function<void()> callback_;
+
+    std::atomic<std::size_t> size_;
+    std::function<void()> tracker_;
+
+    /**
+     * @brief Links node at the head, safe for concurrent producers.
+    **/
+    void link(Node* node);
+
+    /**
+     * @brief Unlinks node at the tail, @b nullptr if nothing is linked or
+     *     a producer has not finished linking yet.
+    **/
+    Node* unlink();
+
+    /**
+     * @brief Wakes up waiters and invokes subscribed callback, locks only
+     *     if anybody waits or is subscribed.
+    **/
+    void notify_pushed();
+
+    /**
+     * @brief Counts pushed (@b grow) or popped item, invokes the tracker
+     *     if the storage turns non-empty or empty.
+    **/
+    void resize(bool grow);
+
+    bool empty_queue() const;
 
 public:
-    MapStorage();
+    QueueStorage();
+
+    /**
+     * @brief Consumer check if storage is empty.
+    **/
+    bool empty();
+
+    /**
+     * @brief Consumer pop @b optional with value upon success.
+    **/
+    std::optional<T> maybe_pop();
+
+    /**
+     * @brief Thread-safe number of items. Items are counted before they are
+     *     linked and after they are unlinked, so it never falls below the
+     *     number of poppable items.
+    **/
+    std::size_t size() const;
+
+    /**
+     * @brief Lock-free @b push_back with @b move semantics.
+    **/
+    QueueStorage& push_back(T&& item);
+
+    /**
+     * @brief Lock-free @b push_back with @b const @b ref semantics.
+    **/
+    QueueStorage& push_back(const T& item);
 
     /**
-     * @brief Thread-safe value observer. Value itself is not necessarily
-     *     thread-safe.
+     * @brief Consumer @b push_front with @b move semantics.
+    **/
+    QueueStorage& push_front(T&& item);
+
+    /**
+     * @brief Consumer @b push_front with @b const @b ref semantics.
+    **/
+    QueueStorage& push_front(const T& item);
+
+    /**
+     * @brief Blocks until storage is non-empty or @b cancel is set.
+     *
+     * @note Whoever sets @b cancel shall call @b notify afterwards.
+    **/
+    void wait(const WakeupFlag& cancel);
+
+    /**
+     * @brief Blocks until storage is non-empty, @b cancel is set or
+     *     @b timeout expires.
+    **/
+    template <typename Rep, typename Period>
+    void wait_for(const WakeupFlag& cancel, std::chrono::duration<Rep, Period> timeout);
+
+    /**
+     * @brief Thread-safe wake up of all waiters (e.g. upon cancellation).
+    **/
+    void notify();
+
+    /**
+     * @brief Thread-safe (un)subscription of a callback invoked upon each
+     *     push. Empty function unsubscribes. No callback is invoked after
+     *     unsubscription returns.
+    **/
+    void subscribe(std::function<void()>&& callback);
+
+    /**
+     * @brief Sets a callback invoked (without locks) whenever the storage
+     *     turns non-empty or empty, shall be set before the storage is shared.
+    **/
+    void track(std::function<void()>&& callback);
+
+    QueueStorage(QueueStorage&&) = delete;
+    QueueStorage(const QueueStorage&) = delete;
+    QueueStorage& operator=(QueueStorage&&) = delete;
+    QueueStorage& operator=(const QueueStorage&) = delete;
+    ~QueueStorage();
+};
+
+template <typename T>
+inline QueueStorage<T>::QueueStorage()
+    : head_(&stub_), tail_(&stub_), stub_(), front_(), mutex_(), cond_(), waiters_(0), subscribed_(false), callback_(), size_(0), tracker_()
+{
+    stub_.next.store(nullptr);
+}
+
+template <typename T>
+inline auto QueueStorage<T>::link(Node* node) -> void
+{
+    node->next.store(nullptr, std::memory_order_relaxed);
+    auto prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node);
+}
+
+template <typename T>
+inline auto QueueStorage<T>::unlink() -> Node*
+{
+    auto tail = tail_;
+    auto next = tail->next.load(std::memory_order_acquire);
+
+    // skip the stub
+    if (tail == &stub_) {
+        if (next == nullptr) { return nullptr; }
+        tail_ = tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+
+    // producer is in the middle of linking
+    if (tail != head_.load(std::memory_order_acquire)) { return nullptr; }
+
+    // the last node is unlinked only after the stub is linked behind it
+    link(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+
+    if (next != nullptr) {
+        tail_ = next;
+        return tail;
+    }
+
+    return nullptr;
+}
+
+template <typename T>
+inline auto QueueStorage<T>::notify_pushed() -> void
+{
+    // pairs with the fences of wait and subscribe (store-load), either the
+    // producer observes the consumer or the consumer observes the item
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (waiters_.load() > 0 || subscribed_.load()) {
+        std::lock_guard lock(mutex_);
+        cond_.notify_all();
+        if (callback_) { callback_(); }
+    }
+}
+
+template <typename T>
+inline auto QueueStorage<T>::resize(bool grow) -> void
+{
+    auto prev = (grow) ? size_.fetch_add(1) : size_.fetch_sub(1);
+    if (tracker_ && prev == ((grow) ? 0 : 1)) { tracker_(); }
+}
+
+template <typename T>
+inline auto QueueStorage<T>::empty_queue() const -> bool
+{
+    auto next = tail_->next.load(std::memory_order_acquire);
+    return (tail_ == &stub_) && (next == nullptr);
+}
+
+template <typename T>
+inline auto QueueStorage<T>::empty() -> bool
+{
+    return front_.empty() && empty_queue();
+}
+
+template <typename T>
+inline auto QueueStorage<T>::maybe_pop() -> std::optional<T>
+{
+    std::optional<T> temp;
+
+    if (!front_.empty()) {
+        temp.emplace(std::move(front_.front()));
+        front_.pop_front();
+        resize(false);
+        return temp;
+    }
+
+    auto node = unlink();
+    if (node != nullptr) {
+        temp = std::move(node->value);
+        delete node;
+        resize(false);
+    }
+
+    return temp;
+}
+
+template <typename T>
+inline auto QueueStorage<T>::size() const -> std::size_t
+{
+    return size_.load();
+}
+
+template <typename T>
+inline auto QueueStorage<T>::push_back(T&& item) -> QueueStorage<T>&
+{
+    resize(true);
+    link(new Node{ {}, std::move(item) });
+    notify_pushed();
+    return *this;
+}
+
+template <typename T>
+inline auto QueueStorage<T>::push_back(const T& item) -> QueueStorage<T>&
+{
+    resize(true);
+    link(new Node{ {}, item });
+    notify_pushed();
+    return *this;
+}
+
+template <typename T>
+inline auto QueueStorage<T>::push_front(T&& item) -> QueueStorage<T>&
+{
+    resize(true);
+    front_.push_front(std::move(item));
+    notify_pushed();
+    return *this;
+}
+
+template <typename T>
+inline auto QueueStorage<T>::push_front(const T& item) -> QueueStorage<T>&
+{
+    resize(true);
+    front_.push_front(item);
+    notify_pushed();
+    return *this;
+}
+
+template <typename T>
+inline auto QueueStorage<T>::wait(const WakeupFlag& cancel) -> void
+{
+    std::unique_lock lock(mutex_);
+    ++waiters_;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cond_.wait(lock, [&]() { return !empty() || cancel.load(); });
+    --waiters_;
+}
+
+template <typename T>
+template <typename Rep, typename Period>
+inline auto QueueStorage<T>::wait_for(const WakeupFlag& cancel, std::chrono::duration<Rep, Period> timeout) -> void
+{
+    std::unique_lock lock(mutex_);
+    ++waiters_;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cond_.wait_for(lock, timeout, [&]() { return !empty() || cancel.load(); });
+    --waiters_;
+}
+
+template <typename T>
+inline auto QueueStorage<T>::notify() -> void
+{
+    std::lock_guard lock(mutex_);
+    cond_.notify_all();
+}
+
+template <typename T>
+inline auto QueueStorage<T>::subscribe(std::function<void()>&& callback) -> void
+{
+    std::lock_guard lock(mutex_);
+    subscribed_.store(static_cast<bool>(callback));
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    callback_ = std::move(callback);
+}
+
+template <typename T>
+inline auto QueueStorage<T>::track(std::function<void()>&& callback) -> void
+{
+    tracker_ = std::move(callback);
+}
+
+template <typename T>
+inline QueueStorage<T>::~QueueStorage()
+{
+    while (maybe_pop().has_value()) {}
+}
+
+
+/**
+ * @brief Unbounded lock-free single-producer single-consumer queue for
+ *     generic (default-constructible) types. Items are stored in blocks of
+ *     @b B items, the producer appends a new block once the last one is
+ *     full, the consumer frees blocks it has drained.
+ *
+ * @note @b push_back shall be called by the single producer, @b maybe_pop
+ *     and @b empty by the single consumer.
+**/
+template <typename T, std::size_t B = 256>
+class SpscQueue final
+{
+private:
+    struct Block
+    {
+        std::array<T, B> items;
+        std::atomic<Block*> next = nullptr;
+    };
+
+    alignas(64) std::atomic<std::size_t> pushed_;
+    alignas(64) Block* tail_block_;
+    std::size_t tail_;
+    alignas(64) Block* head_block_;
+    std::size_t head_;
+    std::size_t popped_;
+
+public:
+    SpscQueue();
+
+    /**
+     * @brief Producer @b push_back with @b move semantics, never blocks.
+    **/
+    void push_back(T&& item);
+
+    /**
+     * @brief Consumer check if the queue is empty.
+    **/
+    bool empty() const;
+
+    /**
+     * @brief Consumer pop @b optional with value upon success.
+    **/
+    std::optional<T> maybe_pop();
+
+    SpscQueue(SpscQueue&&) = delete;
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(SpscQueue&&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+    ~SpscQueue();
+};
+
+template <typename T, std::size_t B>
+inline SpscQueue<T, B>::SpscQueue()
+    : pushed_(0), tail_block_(new Block()), tail_(0), head_block_(tail_block_), head_(0), popped_(0)
+{
+    static_assert(B > 0, "Block shall hold at least one item.");
+}
+
+template <typename T, std::size_t B>
+inline auto SpscQueue<T, B>::push_back(T&& item) -> void
+{
+    // new block is linked before the item is published
+    if (tail_ == B) {
+        auto block = new Block();
+        tail_block_->next.store(block, std::memory_order_release);
+        tail_block_ = block;
+        tail_ = 0;
+    }
+
+    tail_block_->items[tail_++] = std::move(item);
+    pushed_.store(pushed_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+template <typename T, std::size_t B>
+inline auto SpscQueue<T, B>::empty() const -> bool
+{
+    return popped_ == pushed_.load(std::memory_order_acquire);
+}
+
+template <typename T, std::size_t B>
+inline auto SpscQueue<T, B>::maybe_pop() -> std::optional<T>
+{
+    if (empty()) { return std::nullopt; }
+
+    if (head_ == B) {
+        auto next = head_block_->next.load(std::memory_order_acquire);
+        delete head_block_;
+        head_block_ = next;
+        head_ = 0;
+    }
+
+    ++popped_;
+    return std::move(head_block_->items[head_++]);
+}
+
+template <typename T, std::size_t B>
+inline SpscQueue<T, B>::~SpscQueue()
+{
+    for (auto block = head_block_; block != nullptr; ) {
+        auto next = block->next.load();
+        delete block;
+        block = next;
+    }
+}
+
+/**
+ * @brief Hash functor used by hash-based storages, pairs are supported.
+**/
+template <typename K>
+struct StorageHash
+{
+    std::size_t operator()(const K& key) const;
+};
+
+template <typename A, typename B>
+struct StorageHash<std::pair<A, B>>
+{
+    std::size_t operator()(const std::pair<A, B>& key) const;
+};
+
+template <typename K>
+inline auto StorageHash<K>::operator()(const K& key) const -> std::size_t
+{
+    return std::hash<K>()(key);
+}
+
+template <typename A, typename B>
+inline auto StorageHash<std::pair<A, B>>::operator()(const std::pair<A, B>& key) const -> std::size_t
+{
+    auto h = StorageHash<A>()(key.first);
+    return h ^ (StorageHash<B>()(key.second) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+
+/**
+ * @brief Thread-safe key-value storage for generic types split into
+ *     @b N independently locked hash-based shards (lock striping).
+ *     Present keys are observed under a shared lock, only insertion upon
+ *     miss takes an exclusive lock of a single shard.
+ *
+ * @note References to values are stable, values are never removed.
+**/
+template <typename K, typename V, std::size_t N = 16, typename Hash = StorageHash<K>>
+class ShardedMapStorage final
+{
+private:
+    struct alignas(64) Shard
+    {
+        std::shared_mutex mutex;
+        std::unordered_map<K, V, Hash> storage;
+    };
+
+    Hash hash_;
+    std::array<Shard, N> shards_;
+
+    Shard& get_shard(const K& key);
+
+public:
+    ShardedMapStorage();
+
+    /**
+     * @brief Thread-safe value observer, value is default-constructed upon
+     *     miss. Value itself is not necessarily thread-safe.
     **/
     V& observe(const K& key);
 
     /**
-     * @brief Thread-safe key collector.
+     * @brief Thread-safe key collector, shards are visited one by one.
     **/
     std::vector<K> keys();
 
-    MapStorage(MapStorage&&) = delete;
-    MapStorage(const MapStorage&) = delete;
-    MapStorage& operator=(MapStorage&&) = delete;
-    MapStorage& operator=(const MapStorage&) = delete;
+    ShardedMapStorage(ShardedMapStorage&&) = delete;
+    ShardedMapStorage(const ShardedMapStorage&) = delete;
+    ShardedMapStorage& operator=(ShardedMapStorage&&) = delete;
+    ShardedMapStorage& operator=(const ShardedMapStorage&) = delete;
 };
 
-template <typename K, typename V>
-inline MapStorage<K, V>::MapStorage()
-    : mutex_(), storage_()
+template <typename K, typename V, std::size_t N, typename Hash>
+inline ShardedMapStorage<K, V, N, Hash>::ShardedMapStorage()
+    : hash_(), shards_()
 {
+    static_assert(N > 0, "Storage shall have at least one shard.");
 }
 
-template <typename K, typename V>
-inline auto MapStorage<K, V>::observe(const K& key) -> V&
+template <typename K, typename V, std::size_t N, typename Hash>
+inline auto ShardedMapStorage<K, V, N, Hash>::get_shard(const K& key) -> Shard&
 {
-    std::lock_guard lock(mutex_);
-    return storage_[key];
+    return shards_[hash_(key) % N];
+}
+
+template <typename K, typename V, std::size_t N, typename Hash>
+inline auto ShardedMapStorage<K, V, N, Hash>::observe(const K& key) -> V&
+{
+    auto&& shard = get_shard(key);
+
+    // read-mostly path, key is likely present
+    {
+        std::shared_lock lock(shard.mutex);
+        auto it = shard.storage.find(key);
+        if (it != shard.storage.end()) { return it->second; }
+    }
+
+    std::lock_guard lock(shard.mutex);
+    return shard.storage.try_emplace(key).first->second;
 }
 
-template <typename K, typename V>
-inline auto MapStorage<K, V>::keys() -> std::vector<K>
+template <typename K, typename V, std::size_t N, typename Hash>
+inline auto ShardedMapStorage<K, V, N, Hash>::keys() -> std::vector<K>
 {
     std::vector<K> result;
-    std::lock_guard lock(mutex_);
 
-    for (auto&& [k, v] : storage_) {
-        result.emplace_back(k);
+    for (auto&& shard : shards_) {
+        std::shared_lock lock(shard.mutex);
+        for (auto&& [k, v] : shard.storage) {
+            result.emplace_back(k);
+        }
     }
 
     return result;
 }
 
 
+/**
+ * @brief Number of shards of global storages, shall be set at compile time.
+**/
+constexpr std::size_t GLOBAL_MAP_SHARDS = 64;
+
+
 using UserId = std::string;
 using Message = std::string;
+using MessageRef = std::shared_ptr<const Message>;
 using UserPair = std::pair<UserId, UserId>;
-using PendingDeque = DequeStorage<Message>;
-using HistoryVector = VectorStorage<Message>;
-using PendingMap = MapStorage<UserId, PendingDeque>;
-using HistoryMap = MapStorage<UserPair, HistoryVector>;
+
+
+/**
+ * @brief Pending message with its id, ids are monotonic within a queue
+ *     and start at 1. The body is shared by all queues it was pushed to
+ *     (room fan-out), so is @b frame (id:body) if encoded in advance.
+**/
+struct PendingMessage
+{
+    uint64_t id;
+    MessageRef body;
+    MessageRef frame = nullptr;
+};
+
+
+using MessageDeque = QueueStorage<Message>;
+using PendingDeque = QueueStorage<PendingMessage>;
+using HistoryRing = RingStorage<Message>;
+using HistoryMap = ShardedMapStorage<UserPair, HistoryRing, GLOBAL_MAP_SHARDS>;
+
+
+/**
+ * @brief Thread-safe {opponent -> pending messages} storage of a user with
+ *     an index of opponents having unread messages. Queues report turning
+ *     non-empty or empty, so the index is maintained without scanning them.
+ *
+ * @note References to queues are stable, queues are never removed.
+**/
+class PendingMap final
+{
+private:
+    std::mutex unread_mutex_;
+    std::unordered_map<UserId, const PendingDeque*> unread_;
+
+    std::mutex mutex_;
+    std::unordered_map<UserId, PendingDeque> storage_;
+
+    /**
+     * @brief Adds or removes @b opponent from the index depending on the
+     *     current size of its queue.
+    **/
+    void track(const UserId& opponent, const PendingDeque& pending);
+
+public:
+    PendingMap();
+
+    /**
+     * @brief Thread-safe queue observer, queue is created upon miss.
+    **/
+    PendingDeque& observe(const UserId& opponent);
+
+    /**
+     * @brief Thread-safe snapshot of opponents with unread messages and
+     *     their counts ordered by name, proportional to their number.
+    **/
+    std::vector<std::pair<UserId, std::size_t>> unread();
+
+    PendingMap(PendingMap&&) = delete;
+    PendingMap(const PendingMap&) = delete;
+    PendingMap& operator=(PendingMap&&) = delete;
+    PendingMap& operator=(const PendingMap&) = delete;
+};
 
 
 /**
@@ -342,7 +1036,7 @@ public:
 };
 
 
-using UserMap = MapStorage<UserId, User>;
+using UserMap = ShardedMapStorage<UserId, User, GLOBAL_MAP_SHARDS>;
 
 
 #endif
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "uring.hpp"
+
+
+/**
+ * @brief Raw system calls, liburing is not required.
+**/
+static int uring_setup(unsigned entries, io_uring_params* params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+
+Uring::Uring(unsigned entries, unsigned buf_count, unsigned buf_size)
+    : fd_(-1), sq_map_(), cq_map_(), sqes_map_(), bufs_map_(), sq_head_(nullptr), sq_tail_(nullptr), sq_array_(nullptr), sq_mask_(0), sq_entries_(0), sq_local_tail_(0), sqes_(nullptr),
+      cq_head_(nullptr), cq_tail_(nullptr), cq_mask_(0), cqes_(nullptr), buf_ring_(nullptr), buf_data_(nullptr), buf_count_(buf_count), buf_size_(buf_size), buf_tail_(0)
+{
+    // completions are processed only upon io_uring_enter by the owning thread
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = 4 * entries;
+    fd_ = uring_setup(entries, &params);
+
+    // older kernels lack the task run flags
+    if (fd_ == -1 && errno == EINVAL) {
+        params = io_uring_params{};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = 4 * entries;
+        fd_ = uring_setup(entries, &params);
+    }
+
+    if (fd_ == -1) { throw std::runtime_error("io_uring cannot be set up."); }
+
+    try {
+        map_rings(params);
+        register_buffers();
+    } catch (...) {
+        release();
+        throw;
+    }
+}
+
+auto Uring::map_rings(const io_uring_params& params) -> void
+{
+    if (!(params.features & IORING_FEAT_NODROP)) { throw std::runtime_error("io_uring drops completions."); }
+
+    sq_map_.size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_.size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    // both rings could share one mapping
+    auto single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) { sq_map_.size = cq_map_.size = std::max(sq_map_.size, cq_map_.size); }
+
+    auto map = [&](Mapping& m, off_t offset) {
+        m.ptr = mmap(nullptr, m.size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        if (m.ptr == MAP_FAILED) { m.ptr = nullptr; throw std::runtime_error("io_uring rings cannot be mapped."); }
+    };
+
+    map(sq_map_, IORING_OFF_SQ_RING);
+    if (single) { cq_map_.ptr = sq_map_.ptr; }
+    else { map(cq_map_, IORING_OFF_CQ_RING); }
+
+    sqes_map_.size = params.sq_entries * sizeof(io_uring_sqe);
+    map(sqes_map_, IORING_OFF_SQES);
+
+    auto sq = static_cast<uint8_t*>(sq_map_.ptr);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+    sqes_ = static_cast<io_uring_sqe*>(sqes_map_.ptr);
+
+    // submission entries are used in ring order
+    for (unsigned i = 0; i < sq_entries_; ++i) { sq_array_[i] = i; }
+
+    auto cq = static_cast<uint8_t*>(cq_map_.ptr);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+auto Uring::register_buffers() -> void
+{
+    bufs_map_.size = buf_count_ * sizeof(io_uring_buf) + static_cast<std::size_t>(buf_count_) * buf_size_;
+    bufs_map_.ptr = mmap(nullptr, bufs_map_.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs_map_.ptr == MAP_FAILED) { bufs_map_.ptr = nullptr; throw std::runtime_error("io_uring buffers cannot be allocated."); }
+
+    // ring descriptors first (page aligned), buffer memory follows
+    buf_ring_ = static_cast<io_uring_buf*>(bufs_map_.ptr);
+    buf_data_ = static_cast<uint8_t*>(bufs_map_.ptr) + buf_count_ * sizeof(io_uring_buf);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = buf_count_;
+    reg.bgid = BUFFER_GROUP;
+
+    if (uring_register(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        throw std::runtime_error("io_uring provided buffer ring cannot be registered.");
+    }
+
+    for (unsigned bid = 0; bid < buf_count_; ++bid) { recycle(static_cast<uint16_t>(bid)); }
+}
+
+auto Uring::supported() -> bool
+{
+    constexpr uint8_t REQUIRED[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_READ, IORING_OP_ASYNC_CANCEL };
+
+    try {
+        Uring ring(8, 8, 64);
+
+        auto size = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+        auto mem = std::make_unique<uint8_t[]>(size);
+        std::memset(mem.get(), 0, size);
+        auto probe = reinterpret_cast<io_uring_probe*>(mem.get());
+
+        if (uring_register(ring.fd_, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == -1) { return false; }
+
+        for (auto op : REQUIRED) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) { return false; }
+        }
+
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+auto Uring::to_submit() const -> unsigned
+{
+    return sq_local_tail_ - *sq_tail_;
+}
+
+auto Uring::get_sqe() -> io_uring_sqe*
+{
+    auto head = std::atomic_ref(*sq_head_).load(std::memory_order_acquire);
+    if (sq_local_tail_ - head >= sq_entries_) { submit_and_wait(0); }
+
+    auto sqe = &sqes_[sq_local_tail_ & sq_mask_];
+    ++sq_local_tail_;
+    std::memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+auto Uring::submit_and_wait(unsigned wait) -> void
+{
+    auto cnt = to_submit();
+    std::atomic_ref(*sq_tail_).store(sq_local_tail_, std::memory_order_release);
+
+    // busy completion ring (overflow) is not an error, completions are reaped by the caller
+    while (uring_enter(fd_, cnt, wait, IORING_ENTER_GETEVENTS) == -1 && errno == EINTR) { }
+}
+
+auto Uring::peek_cqe() -> io_uring_cqe*
+{
+    auto head = *cq_head_;
+    auto tail = std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+
+    return (head == tail) ? (nullptr) : (&cqes_[head & cq_mask_]);
+}
+
+auto Uring::seen() -> void
+{
+    std::atomic_ref(*cq_head_).store(*cq_head_ + 1, std::memory_order_release);
+}
+
+auto Uring::buffer(uint16_t bid) const -> const uint8_t*
+{
+    return buf_data_ + static_cast<std::size_t>(bid) * buf_size_;
+}
+
+auto Uring::recycle(uint16_t bid) -> void
+{
+    auto&& buf = buf_ring_[buf_tail_ & (buf_count_ - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(buffer(bid));
+    buf.len = buf_size_;
+    buf.bid = bid;
+
+    // tail overlays reserved field of the first descriptor (io_uring_buf_ring
+    // flexible array is misplaced when compiled as C++)
+    ++buf_tail_;
+    std::atomic_ref(buf_ring_[0].resv).store(buf_tail_, std::memory_order_release);
+}
+
+auto Uring::release() -> void
+{
+    // completion ring aliases the submission ring with single mmap
+    if (cq_map_.ptr == sq_map_.ptr) { cq_map_.ptr = nullptr; }
+
+    for (auto&& m : { &sqes_map_, &bufs_map_, &sq_map_, &cq_map_ }) {
+        if (m->ptr != nullptr) { munmap(m->ptr, m->size); m->ptr = nullptr; }
+    }
+
+    if (fd_ != -1) { close(fd_); fd_ = -1; }
+}
+
+Uring::~Uring()
+{
+    release();
+}
@@ -0,0 +1,117 @@
+#ifndef URING_HPP_
+#define URING_HPP_
+
+
+/**
+ * @file
+ *
+ * This header file declares thin io_uring wrapper Uring built on raw
+ * system calls.
+**/
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+
+/**
+ * @brief Submission and completion rings of one io_uring instance with
+ *     a ring of provided receive buffers (buffer group @b BUFFER_GROUP).
+ *
+ * @note Shall be used by one thread only. Requires a kernel with provided
+ *     buffer rings and multishot accept (5.19+), the constructor throws
+ *     @b std::runtime_error otherwise.
+**/
+class Uring final
+{
+private:
+    struct Mapping
+    {
+        void* ptr = nullptr;
+        std::size_t size = 0;
+    };
+
+    int fd_;
+    Mapping sq_map_;
+    Mapping cq_map_;
+    Mapping sqes_map_;
+    Mapping bufs_map_;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_array_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned sq_local_tail_;
+    io_uring_sqe* sqes_;
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+
+    io_uring_buf* buf_ring_;
+    uint8_t* buf_data_;
+    unsigned buf_count_;
+    unsigned buf_size_;
+    uint16_t buf_tail_;
+
+    void map_rings(const io_uring_params& params);
+    void register_buffers();
+    void release();
+
+    /**
+     * @brief Number of prepared but not submitted entries.
+    **/
+    unsigned to_submit() const;
+
+public:
+    static constexpr uint16_t BUFFER_GROUP = 0;
+
+    /**
+     * @param entries submission ring size.
+     * @param buf_count number of provided buffers, power of two.
+     * @param buf_size bytes of one provided buffer.
+    **/
+    Uring(unsigned entries, unsigned buf_count, unsigned buf_size);
+
+    /**
+     * @brief Checks if the kernel supports everything used by the server.
+    **/
+    static bool supported();
+
+    /**
+     * @brief Returns zeroed submission entry, full ring is submitted first.
+    **/
+    io_uring_sqe* get_sqe();
+
+    /**
+     * @brief Submits prepared entries and waits for at least @b wait
+     *     completions by one system call.
+    **/
+    void submit_and_wait(unsigned wait);
+
+    /**
+     * @brief Next completion or @b nullptr, shall be followed by @b seen .
+    **/
+    io_uring_cqe* peek_cqe();
+    void seen();
+
+    /**
+     * @brief Provided buffer with id @b bid .
+    **/
+    const uint8_t* buffer(uint16_t bid) const;
+
+    /**
+     * @brief Returns consumed provided buffer back to the kernel.
+    **/
+    void recycle(uint16_t bid);
+
+    Uring(Uring&&) = delete;
+    Uring(const Uring&) = delete;
+    Uring& operator=(Uring&&) = delete;
+    Uring& operator=(const Uring&) = delete;
+    ~Uring();
+};
+
+
+#endif
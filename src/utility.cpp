@@ -1,41 +1,73 @@
 #include <algorithm>
+#include <array>
 #include <cctype>
 #include <stdexcept>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include "utility.hpp"
 
 
+constexpr bool is_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+
 auto split_string(const std::string& input) -> std::vector<std::string>
 {
-    std::string token;
     std::vector<std::string> result;
-    std::unordered_set<char> seps{ ' ', '\t', '\r' };
 
-    for (std::size_t i = 0; i < input.size(); ++i) {
+    for (std::size_t i = 0; i < input.size();) {
+        while (i < input.size() && is_separator(input[i])) { ++i; }
 
-        //separator found
-        if (seps.contains(input[i])) {
-            if (token.size() > 0) {
-                result.emplace_back(std::move(token));
-            }
-        } else {
-            token.push_back(input[i]);
-        }
-    }
+        auto beg = i;
+        while (i < input.size() && !is_separator(input[i])) { ++i; }
 
-    if (token.size() > 0) {
-        result.emplace_back(std::move(token));
+        if (i > beg) { result.emplace_back(input, beg, i - beg); }
     }
 
     return result;
 }
 
 
-auto is_user_name_valid(const std::string& name) -> bool
+auto split_string(std::string_view input, std::string_view* words, std::size_t max) -> std::size_t
+{
+    std::size_t cnt = 0;
+
+    for (std::size_t i = 0; i < input.size();) {
+        while (i < input.size() && is_separator(input[i])) { ++i; }
+
+        auto beg = i;
+        while (i < input.size() && !is_separator(input[i])) { ++i; }
+
+        // words beyond the limit are counted only
+        if (i > beg) {
+            if (cnt < max) { words[cnt] = input.substr(beg, i - beg); }
+            ++cnt;
+        }
+    }
+
+    return cnt;
+}
+
+
+auto is_user_name_valid(std::string_view name) -> bool
 {
+    // ASCII alphanumeric chars, no locale lookups
     return name.size() > 0
-        && std::all_of(name.begin(), name.end(), [](char c) { return std::isalnum(c); });
+        && std::all_of(name.begin(), name.end(), [](char c) {
+            return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        });
+}
+
+
+auto is_room_name_valid(std::string_view name) -> bool
+{
+    return name.starts_with('#') && is_user_name_valid(name.substr(1));
 }
 
 
@@ -60,6 +92,53 @@ auto parse_port(const std::string& word) -> uint16_t
 }
 
 
+auto parse_count(const std::string& word) -> std::size_t
+{
+    auto count = parse_limit(word);
+
+    if (count == 0) {
+        throw std::invalid_argument("Count shall be positive.");
+    }
+
+    return count;
+}
+
+
+auto parse_limit(const std::string& word) -> std::size_t
+{
+    auto d = word.size() > 0 && std::all_of(word.begin(), word.end(), [](char c) {
+        return std::isdigit(c);
+    });
+
+    if (!d) {
+        throw std::invalid_argument("Count is not properly formatted.");
+    }
+
+    return static_cast<std::size_t>(std::strtoul(word.c_str(), nullptr, 10));
+}
+
+
+auto crc32(const uint8_t* data, std::size_t len, uint32_t crc) -> uint32_t
+{
+    static const auto table = []() {
+        std::array<uint32_t, 256> t;
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) { c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1); }
+            t[i] = c;
+        }
+        return t;
+    }();
+
+    crc = ~crc;
+    for (std::size_t i = 0; i < len; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+
 auto create_new_socket() -> int
 {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -79,9 +158,36 @@ auto allow_socket_reuse(int sock) -> void
 }
 
 
+auto allow_port_sharing(int sock) -> void
+{
+    int val = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) == -1) {
+        throw std::runtime_error("Socket cannot be properly configured.");
+    }
+}
+
+
+auto set_socket_no_delay(int sock) -> void
+{
+    int val = 1;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val)) == -1) {
+        throw std::runtime_error("Socket cannot be properly configured.");
+    }
+}
+
+
 auto set_socket_non_blocking(int sock) -> void
 {
     if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) == -1) {
         throw std::runtime_error("Socket cannot be properly configured.");
     }
 }
+
+
+auto pin_thread(std::thread& thread, std::size_t core) -> bool
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % std::max(1U, std::thread::hardware_concurrency()), &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+}
@@ -9,6 +9,10 @@
  * used within @b cchat application.
 **/
 #include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_set>
 #include <vector>
 
@@ -19,10 +23,25 @@
 std::vector<std::string> split_string(const std::string& input);
 
 
+/**
+ * @brief Splits string on @b char separators without allocation, up to
+ *     @b max words are stored as views of the input.
+ *
+ * @return Number of all words in the input.
+**/
+std::size_t split_string(std::string_view input, std::string_view* words, std::size_t max);
+
+
 /**
  * @brief Checks if user name is a non-trivial string with alphanumeric chars.
 **/
-bool is_user_name_valid(const std::string& name);
+bool is_user_name_valid(std::string_view name);
+
+
+/**
+ * @brief Checks if room name is a valid user name prefixed by @b # .
+**/
+bool is_room_name_valid(std::string_view name);
 
 
 /**
@@ -32,6 +51,27 @@ bool is_user_name_valid(const std::string& name);
 uint16_t parse_port(const std::string& word);
 
 
+/**
+ * @brief Convert string to a positive count (e.g. number of threads).
+ *     Invalid input is reported via exception.
+**/
+std::size_t parse_count(const std::string& word);
+
+
+/**
+ * @brief Convert string to a non-negative limit, zero usually disables it.
+ *     Invalid input is reported via exception.
+**/
+std::size_t parse_limit(const std::string& word);
+
+
+/**
+ * @brief Computes CRC-32 (IEEE 802.3) checksum of a byte range, @b crc
+ *     continues previously computed checksum.
+**/
+uint32_t crc32(const uint8_t* data, std::size_t len, uint32_t crc = 0);
+
+
 /**
  * @brief Creates new POSIX socket.
  *     Throws exception if new socket cannot be created.
@@ -46,6 +86,21 @@ int create_new_socket();
 void allow_socket_reuse(int sock);
 
 
+/**
+ * @brief Allows several sockets to listen on the same port, the kernel
+ *     spreads incoming connections among them.
+ *     Throws exception if socket cannot be configured.
+**/
+void allow_port_sharing(int sock);
+
+
+/**
+ * @brief Disables Nagle's algorithm, small packets go out immediately.
+ *     Throws exception if socket cannot be configured.
+**/
+void set_socket_no_delay(int sock);
+
+
 /**
  * @brief Sets non-blocking mode on the socket.
  *     Throws exception if socket cannot be configured non-blocking.
@@ -53,4 +108,11 @@ void allow_socket_reuse(int sock);
 void set_socket_non_blocking(int sock);
 
 
+/**
+ * @brief Pins thread to core @b core modulo the number of cores.
+ *     Returns false if the thread cannot be pinned.
+**/
+bool pin_thread(std::thread& thread, std::size_t core);
+
+
 #endif